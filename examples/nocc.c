@@ -4,20 +4,38 @@
 #include <stdio.h>
 
 const char* BINARY_PATH = "./bin"; 
+const char* SOCKET_PATH = "./.nocc.sock";
 
 typedef struct {
     bool build;
+    bool serve;
+    bool stop;
     bool run;
     bool help;
     bool version;
+    bool watch;
+    bool keep_going;
+    bool verbose;
     char* config;
     char* project_name;
+    char* trace;
+    long jobs;
+    long load;
+    long memory;
 } nocc_ap_parse_result;
 
+void create_helloworld_graph(nocc_ap_parse_result* result, nocc_graph* graph);
+void source_filter(nocc_filter* filter);
+void read_sources(const nocc_filter* filter, nocc_darray(const char*)* sources);
+void server_key(const nocc_ap_parse_result* result, char* key, size_t size);
 bool build_helloworlds(nocc_ap_parse_result* result);
+bool serve_helloworlds(nocc_ap_parse_result* result);
+bool watch_helloworlds(nocc_graph* graph, nocc_jobs* jobs);
 bool run_helloworlds(nocc_ap_parse_result* result);
 
 int main(int argc, char** argv) {
+    NOCC_REBUILD_SELF(argc, argv);
+
     nocc_ap_parse_result result = {};
 
     nocc_argparse_opt switch_args[] = {
@@ -27,6 +45,13 @@ int main(int argc, char** argv) {
 
     nocc_argparse_opt build_options[] = {
         nocc_ap_opt_switch(switch_args, "debug", &(result.config)),
+        nocc_ap_opt_boolean('w', "watch", "Rebuilds whenever a file changes", NULL, &(result.watch)),
+        nocc_ap_opt_boolean('k', "keep-going", "Builds as much as possible instead of stopping at the first error", NULL, &(result.keep_going)),
+        nocc_ap_opt_number('j', "jobs", "The amount of commands to run at once (default=number of cpus)", NULL, &(result.jobs)),
+        nocc_ap_opt_number('l', "load", "Starts no new commands while the load average is above this", NULL, &(result.load)),
+        nocc_ap_opt_number('m', "memory", "Starts no new commands while less than this many MiB of memory are available", NULL, &(result.memory)),
+        nocc_ap_opt_boolean('v', "verbose", "Also prints the debug and trace messages", NULL, &(result.verbose)),
+        nocc_ap_opt_string('t', "trace", "Writes a timeline of the build to the file, open it in chrome://tracing or ui.perfetto.dev", NULL, &(result.trace)),
         nocc_ap_opt_boolean('h', "help", "Prints this message", NULL, &(result.help))
     };
 
@@ -34,6 +59,15 @@ int main(int argc, char** argv) {
         nocc_ap_arg_string("project_name", "Builds the project", "all", &(result.project_name))
     };
 
+    nocc_argparse_opt serve_options[] = {
+        nocc_ap_opt_switch(switch_args, "debug", &(result.config)),
+        nocc_ap_opt_boolean('k', "keep-going", "Builds as much as possible instead of stopping at the first error", NULL, &(result.keep_going)),
+        nocc_ap_opt_number('j', "jobs", "The amount of commands to run at once (default=number of cpus)", NULL, &(result.jobs)),
+        nocc_ap_opt_boolean('s', "stop", "Stops the running server", NULL, &(result.stop)),
+        nocc_ap_opt_boolean('v', "verbose", "Also prints the debug and trace messages", NULL, &(result.verbose)),
+        nocc_ap_opt_boolean('h', "help", "Prints this message", NULL, &(result.help))
+    };
+
     nocc_argparse_opt run_options[] = {
         nocc_ap_opt_boolean('h', "help", "Prints this message", NULL, &(result.help))
     };
@@ -45,6 +79,7 @@ int main(int argc, char** argv) {
 
     nocc_argparse_opt subcommands[] = { 
         nocc_ap_cmd("build", "Builds the project", build_options, build_arguments, NULL, &(result.build)),
+        nocc_ap_cmd("serve", "Keeps the project in memory, so builds only check what changed", serve_options, NULL, NULL, &(result.serve)),
         nocc_ap_cmd("run", "runs the project", run_options, NULL, NULL, &(result.run))
     };
 
@@ -52,6 +87,7 @@ int main(int argc, char** argv) {
 
 
     nocc_ap_parse(&program, argc, argv);
+    if(result.verbose) nocc_log_set_level(NOCC_LOG_LEVEL_TRACE);
 
     int status = 0;
 
@@ -71,12 +107,33 @@ int main(int argc, char** argv) {
         }
     }
 
-    else if (result.run) {
+    else if(result.serve) {
         if(result.help) {
             nocc_ap_usage(&program.commands[1]);
             goto failure;
         }
 
+        if(result.stop) {
+            if(!nocc_client_stop(SOCKET_PATH)) {
+                nocc_error("no server is running");
+                status = 1;
+            }
+            goto failure;
+        }
+
+        if(!serve_helloworlds(&result)) {
+            nocc_error("unable to serve helloworld");
+            status = 1;
+            goto failure;
+        }
+    }
+
+    else if (result.run) {
+        if(result.help) {
+            nocc_ap_usage(&program.commands[2]);
+            goto failure;
+        }
+
         if(!run_helloworlds(&result)) {
             nocc_error("unable to run helloworld");
             status = 1;
@@ -101,51 +158,173 @@ int main(int argc, char** argv) {
     }
 
 failure:
-    return 0;
+    return status;
 }
 
 #define _NOCC_USE_NEW_GEN_FUNCTION_
 
-bool build_helloworlds(nocc_ap_parse_result* result) {
+// The sources and headers, without what the build puts next to them
+void source_filter(nocc_filter* filter) {
+    nocc_filter_init(filter);
+    nocc_filter_include(filter, "*.c");
+    nocc_filter_include(filter, "*.h");
+    nocc_filter_exclude(filter, ".git/");
+    nocc_filter_exclude(filter, ".nocc_cache/");
+    nocc_filter_exclude(filter, "bin/");
+}
+
+void read_sources(const nocc_filter* filter, nocc_darray(const char*)* sources) {
+    // Directories that did not change are not read again
+    nocc_dir_cache_enable("./.nocc_dirs");
+    nocc_read_dir_filtered(".", filter, sources);
+}
+
+void create_helloworld_graph(nocc_ap_parse_result* result, nocc_graph* graph) {
     static const char* TARGET_DIR = "./helloworld.exe";
     
     const char* helloworld_c = "./helloworld.c";
-    const char* helloworld_o = "./helloworld.o";
-
-    // TODO: The nocc_should_recompile function should not be exposed to the user.
-    if(nocc_should_recompile(&helloworld_c, 1, helloworld_o)) {
-        printf("Compiling ./helloworld.c");
-
-        // Compiling the file
-        nocc_darray(const char*) cmd = nocc_da_create(const char*);
-        nocc_cmd_add(cmd, "clang");
-        if(strcmp(result->config, "debug") == 0) {
-            nocc_cmd_add(cmd, "-g", "-O0");
-        } else if(strcmp(result->config, "release") == 0){ 
-            nocc_cmd_add(cmd, "-O2");
-        }
-        
-        nocc_cmd_add(cmd, "-c", helloworld_c, "-o", helloworld_o);
-        nocc_cmd_execute(cmd);
-        
-        nocc_da_free(cmd);
+
+    // The objects mirror the sources under ./bin/obj, nocc_graph_build creates the directories.
+    // The graph only points to the names, so they are kept for as long as the program runs.
+    static nocc_darray(nocc_string) objects = NULL;
+    if(objects == NULL) {
+        nocc_darray(const char*) sources = nocc_da_create(const char*);
+        nocc_da_push(sources, helloworld_c);
+        nocc_generate_object_files(objects, sources, "%s/obj/%p/%b.o", BINARY_PATH);
+        nocc_da_free(sources);
+    }
+    const char* helloworld_o = objects[0];
+
+    // Changing the flags rebuilds, a touched but unchanged file (e.g. after a git checkout) does not
+    nocc_db_load("./.nocc_db", true);
+    // For clangd and clang-tidy
+    nocc_compdb_enable("./compile_commands.json");
+    // Switching branches back and forth gets the objects from the cache instead of the compiler
+    nocc_cache_enable("./.nocc_cache", false);
+
+    nocc_graph_init(graph);
+    graph->on_failure = result->keep_going ? NOCC_KEEP_GOING : NOCC_FAIL_FAST;
+
+    // Compiling the file
+    nocc_target* compile = nocc_graph_add(graph, helloworld_c);
+    nocc_target_inputs(compile, helloworld_c);
+    nocc_target_outputs(compile, helloworld_o);
+    nocc_target_cmd(compile, "clang");
+    if(strcmp(result->config, "debug") == 0) {
+        nocc_target_cmd(compile, "-g", "-O0");
+    } else if(strcmp(result->config, "release") == 0){ 
+        nocc_target_cmd(compile, "-O2");
     }
+    nocc_target_cmd(compile, "-c", helloworld_c, "-o", helloworld_o);
+    nocc_target_depfile(compile, NULL);
+
+    // Linking the file, the object comes in through the dependency
+    nocc_target* link = nocc_graph_add(graph, TARGET_DIR);
+    nocc_target_depends_on(link, compile);
+    nocc_target_outputs(link, TARGET_DIR);
+    nocc_target_cmd(link, "clang", "-o", TARGET_DIR, helloworld_o);
+    // Links take more memory than a compile
+    link->weight = 2;
+}
+
+// Everything that changes how the server would build, `serve` has no -l and -m so builds using them are not served
+void server_key(const nocc_ap_parse_result* result, char* key, size_t size) {
+    snprintf(key, size, "%s -k%d -j%ld -l%ld -m%ld", result->config, result->keep_going, result->jobs, result->load, result->memory);
+}
 
-    if(nocc_should_recompile(&helloworld_o, 1, TARGET_DIR)) {
-        // Linking the file
-        nocc_darray(const char*) cmd = nocc_da_create(const char*);
-        nocc_cmd_add(cmd, "clang", "-o", TARGET_DIR, helloworld_o);
-                
-        nocc_cmd_execute(cmd);
-            
-        nocc_da_free(cmd);
+bool build_helloworlds(nocc_ap_parse_result* result) {
+    // A running `nocc serve` already has everything in memory. It refuses if it was started with other options.
+    if(!result->watch && !result->trace) {
+        char key[128];
+        server_key(result, key, sizeof(key));
+        int status = nocc_client_build(SOCKET_PATH, key);
+        if(status >= 0) return status == 0;
     }
 
+    if(result->trace) nocc_trace_enable(result->trace);
 
-    return true;
+    nocc_graph graph;
+    create_helloworld_graph(result, &graph);
+
+    nocc_jobs jobs;
+    nocc_jobs_init(&jobs, result->jobs > 0 ? (size_t)result->jobs : 0);
+    nocc_jobs_limit(&jobs, (double)result->load, result->memory > 0 ? (uint64_t)result->memory : 0);
+
+    bool status = nocc_graph_build(&graph, &jobs);
+    if(result->watch) {
+        status = watch_helloworlds(&graph, &jobs);
+    }
+
+    nocc_jobs_free(&jobs);
+    nocc_graph_free(&graph);
+    return status;
+}
+
+// Keeps the graph around and only rebuilds what the saved files affect, until interrupted.
+bool watch_helloworlds(nocc_graph* graph, nocc_jobs* jobs) {
+    nocc_filter filter;
+    source_filter(&filter);
+    nocc_darray(const char*) sources = nocc_da_create(const char*);
+    read_sources(&filter, &sources);
+
+    nocc_watch watch;
+    if(!nocc_watch_init(&watch)) return false;
+    // The outputs of the builds it triggers would wake it up again
+    nocc_watch_filter(&watch, &filter);
+    nocc_watch_add_files(&watch, sources, nocc_da_size(sources));
+    nocc_info("Watching for changes...");
+
+    for(;;) {
+        nocc_darray(char*) changed = nocc_da_create(char*);
+        if(!nocc_watch_wait(&watch, 100, &changed)) break;
+
+        if(watch.overflow) nocc_graph_build(graph, jobs);
+        else               nocc_graph_build_changed(graph, jobs, (const char**)changed, nocc_da_size(changed));
+
+        for(size_t i = 0; i < nocc_da_size(changed); i++) free(changed[i]);
+        nocc_da_free(changed);
+    }
+
+    nocc_watch_free(&watch);
+    nocc_filter_free(&filter);
+    for(size_t i = 0; i < nocc_da_size(sources); i++) free((char*)sources[i]);
+    nocc_da_free(sources);
+    return false;
+}
+
+bool serve_helloworlds(nocc_ap_parse_result* result) {
+    nocc_graph graph;
+    create_helloworld_graph(result, &graph);
+
+    nocc_jobs jobs;
+    nocc_jobs_init(&jobs, result->jobs > 0 ? (size_t)result->jobs : 0);
+
+    nocc_filter filter;
+    source_filter(&filter);
+    nocc_darray(const char*) sources = nocc_da_create(const char*);
+    read_sources(&filter, &sources);
+
+    bool status = false;
+    nocc_watch watch;
+    if(nocc_watch_init(&watch)) {
+        nocc_watch_filter(&watch, &filter);
+        nocc_watch_add_files(&watch, sources, nocc_da_size(sources));
+        char key[128];
+        server_key(result, key, sizeof(key));
+        status = nocc_serve(SOCKET_PATH, key, &graph, &jobs, &watch);
+    }
+
+    nocc_watch_free(&watch);
+    nocc_filter_free(&filter);
+    for(size_t i = 0; i < nocc_da_size(sources); i++) free((char*)sources[i]);
+    nocc_da_free(sources);
+    nocc_jobs_free(&jobs);
+    nocc_graph_free(&graph);
+    return status;
 }
 
 bool run_helloworlds(nocc_ap_parse_result* result) {
+    (void)result;
     printf("Running helloworld.c\n");
     nocc_darray(const char*) cmd = nocc_da_create(const char*);
     nocc_cmd_add(cmd, ".\\helloworld.exe");
@@ -0,0 +1,59 @@
+#include "../nocc.h"
+
+#include <string.h>
+#include <stdio.h>
+
+// Compares how fast nocc starts processes against a plain fork + execvp.
+// The cost of fork grows with the memory of the parent (the page tables are copied),
+// a build that holds a large graph pays that for every command it launches.
+//
+//     cc spawn_bench.c -o spawn_bench && ./spawn_bench [count] [heap MiB]
+
+#ifndef _WIN32
+static pid_t fork_exec(char** argv) {
+    pid_t cpid = fork();
+    if(cpid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    return cpid;
+}
+#endif // _WIN32
+
+int main(int argc, char** argv) {
+    long count = argc > 1 ? strtol(argv[1], NULL, 10) : 2000;
+    long heap_mib = argc > 2 ? strtol(argv[2], NULL, 10) : 512;
+
+    // Touch every page so it is really mapped
+    size_t heap_size = (size_t)heap_mib << 20;
+    char* heap = malloc(heap_size);
+    if(heap_size) memset(heap, 1, heap_size);
+
+    nocc_darray(const char*) cmd = nocc_da_create(const char*);
+#ifdef _WIN32
+    nocc_cmd_add(cmd, "cmd.exe", "/c", "exit");
+#else
+    nocc_cmd_add(cmd, "true");
+#endif // _WIN32
+
+    int64_t start = nocc_now_ns();
+    for(long i = 0; i < count; i++) {
+        _nocc_cmd_pid_wait(_nocc_cmd_run_command_async(cmd));
+    }
+    int64_t spawn_ns = nocc_now_ns() - start;
+    printf("nocc spawn:  %ld processes in %.3fs (%.1f us each, %ld MiB heap)\n", count, spawn_ns / 1e9, spawn_ns / 1e3 / count, heap_mib);
+
+#ifndef _WIN32
+    char* fork_argv[] = { "true", NULL };
+    start = nocc_now_ns();
+    for(long i = 0; i < count; i++) {
+        _nocc_cmd_pid_wait(fork_exec(fork_argv));
+    }
+    int64_t fork_ns = nocc_now_ns() - start;
+    printf("fork + exec: %ld processes in %.3fs (%.1f us each, %ld MiB heap)\n", count, fork_ns / 1e9, fork_ns / 1e3 / count, heap_mib);
+#endif // _WIN32
+
+    nocc_da_free(cmd);
+    free(heap);
+    return 0;
+}
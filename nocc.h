@@ -9,6 +9,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN 
@@ -18,8 +19,23 @@
     #include <unistd.h>
     #include <sys/stat.h>
     #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
     #include <dirent.h>
     #include <libgen.h>
+    #include <poll.h>
+    #include <spawn.h>
+    #include <signal.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #ifdef __linux__
+        #include <sys/inotify.h>
+        #include <sys/epoll.h>
+        #include <sys/syscall.h>
+    #endif
 #endif
 
 // DEFS
@@ -36,40 +52,180 @@
     #define nocc_debugbreak     __builtin_trap
 #endif
 
+// For the little that is shared between threads (the log, the directory scanner)
+#ifdef _WIN32
+    typedef SRWLOCK                 _nocc_mutex;
+    #define _NOCC_MUTEX_INIT        SRWLOCK_INIT
+    #define _nocc_mutex_init(m)     InitializeSRWLock(m)
+    #define _nocc_mutex_destroy(m)  ((void)(m))
+    #define _nocc_mutex_lock(m)     AcquireSRWLockExclusive(m)
+    #define _nocc_mutex_unlock(m)   ReleaseSRWLockExclusive(m)
+    typedef CONDITION_VARIABLE      _nocc_cond;
+    #define _nocc_cond_init(c)      InitializeConditionVariable(c)
+    #define _nocc_cond_destroy(c)   ((void)(c))
+    #define _nocc_cond_wait(c, m)   SleepConditionVariableSRW((c), (m), INFINITE, 0)
+    #define _nocc_cond_signal(c)    WakeConditionVariable(c)
+    #define _nocc_cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+    typedef pthread_mutex_t         _nocc_mutex;
+    #define _NOCC_MUTEX_INIT        PTHREAD_MUTEX_INITIALIZER
+    #define _nocc_mutex_init(m)     pthread_mutex_init((m), NULL)
+    #define _nocc_mutex_destroy(m)  pthread_mutex_destroy(m)
+    #define _nocc_mutex_lock(m)     pthread_mutex_lock(m)
+    #define _nocc_mutex_unlock(m)   pthread_mutex_unlock(m)
+    typedef pthread_cond_t          _nocc_cond;
+    #define _nocc_cond_init(c)      pthread_cond_init((c), NULL)
+    #define _nocc_cond_destroy(c)   pthread_cond_destroy(c)
+    #define _nocc_cond_wait(c, m)   pthread_cond_wait((c), (m))
+    #define _nocc_cond_signal(c)    pthread_cond_signal(c)
+    #define _nocc_cond_broadcast(c) pthread_cond_broadcast(c)
+#endif // _WIN32
+
 // Logging Begin ==========================================================
 typedef enum {
     NOCC_LOG_LEVEL_TRACE, NOCC_LOG_LEVEL_DEBUG, NOCC_LOG_LEVEL_INFO, NOCC_LOG_LEVEL_WARN, NOCC_LOG_LEVEL_ERROR, 
     NOCC_LOG_LEVEL_OFF
 } nocc_log_level;
 
-#define buffer_size  1024
+// Calls below this level are compiled out, 0 = trace, 1 = debug, 2 = info, ... (the preprocessor cannot see the enum)
+#ifndef NOCC_LOG_MIN_LEVEL
+    #define NOCC_LOG_MIN_LEVEL      0
+#endif // NOCC_LOG_MIN_LEVEL
+
+// Lines are collected here and written in one go when it fills up, before commands run, and before nocc blocks
+#ifndef NOCC_LOG_BUFFER_SIZE
+    #define NOCC_LOG_BUFFER_SIZE    (16 * 1024)
+#endif // NOCC_LOG_BUFFER_SIZE
+
+typedef struct {
+    nocc_log_level threshold;
+    bool registered;
+    size_t size;
+    char buffer[NOCC_LOG_BUFFER_SIZE];
+    _nocc_mutex lock;
+} _nocc_log_t;
+
+static _nocc_log_t _nocc_log = { .threshold = NOCC_LOG_LEVEL_INFO, .lock = _NOCC_MUTEX_INIT };
+
+/**
+ * @brief Sets the lowest level that gets printed, NOCC_LOG_LEVEL_INFO by default. Messages below it are not even formatted.
+ * 
+ * @param {nocc_log_level} level -- the level, NOCC_LOG_LEVEL_OFF silences everything
+ * 
+ * @return {void}
+*/
+void nocc_log_set_level(nocc_log_level level) {
+    _nocc_log.threshold = level;
+}
+
+// Expects the lock to be held
+void _nocc_log_flush_locked(void) {
+    // Whatever the build script printf'ed before has to come first
+    fflush(stdout);
+    if(_nocc_log.size > 0) {
+        fwrite(_nocc_log.buffer, 1, _nocc_log.size, stdout);
+        fflush(stdout);
+        _nocc_log.size = 0;
+    }
+}
+
+/**
+ * @brief Writes out the buffered log lines. nocc does this itself before it runs a command or waits, call it before writing
+ * to stdout some other way.
+ * 
+ * @return {void}
+*/
+void nocc_log_flush(void) {
+    _nocc_mutex_lock(&_nocc_log.lock);
+    _nocc_log_flush_locked();
+    _nocc_mutex_unlock(&_nocc_log.lock);
+}
+
+// Expects the lock to be held
+void _nocc_log_append(const char* data, size_t size) {
+    if(_nocc_log.size + size > NOCC_LOG_BUFFER_SIZE) _nocc_log_flush_locked();
+    if(size > NOCC_LOG_BUFFER_SIZE) {
+        fwrite(data, 1, size, stdout);
+        return;
+    }
+    memcpy(_nocc_log.buffer + _nocc_log.size, data, size);
+    _nocc_log.size += size;
+}
+
 int _nocc_log_output(nocc_log_level level, const char* fmt, ...) {
-    static const char* levels[NOCC_LOG_LEVEL_OFF] = { "trace", "debug", "info", "warn", "error" };
-    char buffer[buffer_size] = {0};
+    static const char* levels[NOCC_LOG_LEVEL_OFF] = { "[trace]: ", "[debug]: ", "[info]: ", "[warn]: ", "[error]: " };
+    // Most lines fit, longer ones get a buffer of their own instead of being cut off
+    char stack[512];
+    char* message = stack;
 
     va_list args;
     va_start(args, fmt);
-    vsprintf_s(buffer, buffer_size, fmt, args);
+    int length = vsnprintf(stack, sizeof(stack), fmt, args);
     va_end(args);
+    if(length < 0) return length;
+
+    if((size_t)length >= sizeof(stack)) {
+        message = malloc((size_t)length + 1);
+        if(message == NULL) return -1;
+        va_start(args, fmt);
+        vsnprintf(message, (size_t)length + 1, fmt, args);
+        va_end(args);
+    }
 
-    int status = printf("[%s]: %s\n", levels[level], buffer);
-    return status;
+    size_t prefix = strlen(levels[level]);
+    _nocc_mutex_lock(&_nocc_log.lock);
+    if(!_nocc_log.registered) {
+        _nocc_log.registered = true;
+        atexit(nocc_log_flush);
+    }
+    _nocc_log_append(levels[level], prefix);
+    _nocc_log_append(message, (size_t)length);
+    _nocc_log_append("\n", 1);
+    // Problems show up right away
+    if(level >= NOCC_LOG_LEVEL_WARN) _nocc_log_flush_locked();
+    _nocc_mutex_unlock(&_nocc_log.lock);
+
+    if(message != stack) free(message);
+    return (int)(prefix + (size_t)length + 1);
 }
 
+// The level is checked before the arguments are evaluated
+#define _nocc_log_at(level, fmt, ...)   ((level) >= _nocc_log.threshold ? _nocc_log_output((level), fmt, ##__VA_ARGS__) : 0)
+// Compiled out, sizeof keeps the format checked and the arguments used without evaluating them
+#define _nocc_log_none(fmt, ...)        ((void)sizeof(printf(fmt, ##__VA_ARGS__)), 0)
+
 /**
  * @brief Logs a formatted output to the console. Either as a 'trace', 'debug', 'info', 'warn', or 'error'.
+ * Nothing is formatted below the level set with nocc_log_set_level, and nothing is compiled below NOCC_LOG_MIN_LEVEL.
  * 
  * @param {const char*} fmt -- the formatted output
  * @param {...} ... -- the arguments which get formatted.
  * 
- * @return {int} returns the amount of bytes printed to the console.
+ * @return {int} returns the amount of bytes logged, 0 if the level is filtered out.
  * 
 */
-#define nocc_trace(fmt, ...)    _nocc_log_output(NOCC_LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
-#define nocc_debug(fmt, ...)    _nocc_log_output(NOCC_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
-#define nocc_info(fmt, ...)     _nocc_log_output(NOCC_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
-#define nocc_warn(fmt, ...)     _nocc_log_output(NOCC_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
-#define nocc_error(fmt, ...)    _nocc_log_output(NOCC_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#if NOCC_LOG_MIN_LEVEL <= 0
+    #define nocc_trace(fmt, ...)    _nocc_log_at(NOCC_LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#else
+    #define nocc_trace(fmt, ...)    _nocc_log_none(fmt, ##__VA_ARGS__)
+#endif
+#if NOCC_LOG_MIN_LEVEL <= 1
+    #define nocc_debug(fmt, ...)    _nocc_log_at(NOCC_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+    #define nocc_debug(fmt, ...)    _nocc_log_none(fmt, ##__VA_ARGS__)
+#endif
+#if NOCC_LOG_MIN_LEVEL <= 2
+    #define nocc_info(fmt, ...)     _nocc_log_at(NOCC_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+    #define nocc_info(fmt, ...)     _nocc_log_none(fmt, ##__VA_ARGS__)
+#endif
+#if NOCC_LOG_MIN_LEVEL <= 3
+    #define nocc_warn(fmt, ...)     _nocc_log_at(NOCC_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+    #define nocc_warn(fmt, ...)     _nocc_log_none(fmt, ##__VA_ARGS__)
+#endif
+// Errors are never compiled out
+#define nocc_error(fmt, ...)        _nocc_log_at(NOCC_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
 
 #ifdef NOCC_DEBUG
     #define NOCC_ENABLE_ASSERTS
@@ -100,13 +256,14 @@ typedef struct {
 // Since these function 
 void* _nocc_da_reserve(size_t stride, size_t cap);
 void  _nocc_da_free(void* array);
-void* _nocc_da_push(void* array, void* value);
-void* _nocc_da_pushn(void* array, size_t n, void* value);
+void* _nocc_da_push(void* array, const void* value);
+void* _nocc_da_pushn(void* array, size_t n, const void* value);
 void* _nocc_da_grow(void* array, size_t new_capacity);
 void* _nocc_da_remove(void* array, size_t index, void* ouput_ptr);
-size_t _nocc_da_size(void* array);
-size_t _nocc_da_capacity(void* array);
-size_t _nocc_da_stride(void* array);
+size_t _nocc_da_size(const void* array);
+size_t _nocc_da_capacity(const void* array);
+size_t _nocc_da_stride(const void* array);
+void  _nocc_da_clear(void* array);
 
 /**
  * @brief a wrapper. To use this as the type. Think of std::vector<T> in C++
@@ -218,6 +375,16 @@ size_t _nocc_da_stride(void* array);
  * 
 */
 #define nocc_da_stride(a)               _nocc_da_stride(a)
+
+/**
+ * @brief empties the array, the capacity stays so it can be filled again without allocating
+ * 
+ * @param {void*} a -- The array
+ * 
+ * @return {void}
+ * 
+*/
+#define nocc_da_clear(a)                _nocc_da_clear(a)
 // Array End ============================================================
 
 // String Begin ==========================================================
@@ -374,6 +541,8 @@ typedef struct nocc_argparse_opt {
 } nocc_argparse_opt;
 
 #define nocc_ap_opt_boolean(sn, ln, desc, def, op) { ._kind=NOCC_APK_OPTION, ._type=NOCC_APT_BOOLEAN, .short_name=(sn), .name=(ln), .description=(desc), .default_=(def), .output_ptr=(op), ._children=NULL, ._length_children=0 }
+#define nocc_ap_opt_number(sn, ln, desc, def, op) { ._kind=NOCC_APK_OPTION, ._type=NOCC_APT_NUMBER, .short_name=(sn), .name=(ln), .description=(desc), .default_=(def), .output_ptr=(op), ._children=NULL, ._length_children=0 }
+#define nocc_ap_opt_string(sn, ln, desc, def, op) { ._kind=NOCC_APK_OPTION, ._type=NOCC_APT_STRING, .short_name=(sn), .name=(ln), .description=(desc), .default_=(def), .output_ptr=(op), ._children=NULL, ._length_children=0 }
 #define nocc_ap_opt_switch(a, def, op) { ._kind=NOCC_APK_OPTION, ._type=NOCC_APT_SWITCH, .short_name=0, .name=NULL, .description=NULL, .default_=(def), .output_ptr=(op), ._children=(a), ._length_children=(sizeof(a) / sizeof(nocc_argparse_opt)) }
 
 #define nocc_ap_arg_string(n, d, def, op) { ._kind=NOCC_APK_ARGUMENT, ._type=NOCC_APT_STRING, .name=(n), .description=(d), .default_=(def), .output_ptr=(op) }
@@ -392,6 +561,7 @@ typedef struct nocc_argparse_opt {
 bool _nocc_ap_parse_rec(nocc_argparse_opt* command, int beg, nocc_darray(char*) args);
 inline bool _nocc_ap_find_if_is_long(char c);
 bool _nocc_ap_get_option_status(nocc_argparse_opt* opt, bool is_long, char* arg);
+char* _nocc_ap_get_option_value(nocc_argparse_opt* opt, bool is_long, int beg, nocc_darray(char*) args, char* arg);
 bool _nocc_ap_parse_option(nocc_argparse_opt* command, int beg, nocc_darray(char*) args, char* arg);
 bool _nocc_ap_parse_argument(nocc_argparse_opt* command, int beg, nocc_darray(char*) args, char* arg);
 void _nocc_ap_set_default_option(nocc_argparse_opt* command);
@@ -497,6 +667,8 @@ bool nocc_ap_usage(nocc_argparse_opt* program) {
                     nocc_str_push_char(usage_string, program->options[i].short_name);
                     nocc_str_push_cstr(usage_string, ", --");
                     nocc_str_push_cstr(usage_string, program->options[i].name);
+                    if(program->options[i]._type == NOCC_APT_NUMBER || program->options[i]._type == NOCC_APT_STRING)
+                        nocc_str_push_cstr(usage_string, " <value>");
                     nocc_str_push_cstr(usage_string, "\t\t\t");
                     nocc_str_push_cstr(usage_string, program->options[i].description);
                     nocc_str_push_char(usage_string, '\n');
@@ -514,6 +686,159 @@ bool nocc_ap_usage(nocc_argparse_opt* program) {
 
 // Argument Parsing End ===================================================
 
+// Trace Begin ============================================================
+
+/**
+ * @brief A monotonic clock, for measuring how long things take.
+ * 
+ * @return {int64_t} nanoseconds since some unspecified point.
+*/
+int64_t nocc_now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (int64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif // _WIN32
+}
+
+// One complete ("ph":"X") event. Names and arguments live in the string arena, events only keep offsets.
+typedef struct {
+    const char* category;
+    size_t name;
+    size_t args;            // the command, SIZE_MAX if there is none
+    size_t slot;            // 0 is nocc itself, job slot i shows up as i + 1
+    int64_t start, end;
+} _nocc_trace_event;
+
+typedef struct {
+    char* path;
+    int64_t epoch;
+    size_t slots;
+    nocc_darray(_nocc_trace_event) events;
+    nocc_string strings;
+} _nocc_trace_t;
+
+static _nocc_trace_t _nocc_trace = {0};
+
+void nocc_trace_write(void);
+
+/**
+ * @brief Records what the build does (commands, directory scans, staleness checks) and writes it to `path`
+ * at exit, in the trace event format chrome://tracing and https://ui.perfetto.dev read.
+ * Events go into buffers allocated here, nothing touches the disk until the end.
+ * 
+ * @param {const char*} path -- where the trace gets written, e.g. "trace.json"
+ * 
+ * @return {void}
+*/
+void nocc_trace_enable(const char* path) {
+    if(_nocc_trace.path) {
+        free(_nocc_trace.path);
+        _nocc_trace.path = strdup(path);
+        return;
+    }
+
+    _nocc_trace.path = strdup(path);
+    _nocc_trace.epoch = nocc_now_ns();
+    _nocc_trace.events = nocc_da_reserve(_nocc_trace_event, 1 << 14);
+    _nocc_trace.strings = nocc_str_reserve(1 << 20);
+    atexit(nocc_trace_write);
+}
+
+// Whether events are recorded, check it before building the name of an event
+#define nocc_tracing() (_nocc_trace.path != NULL)
+
+// Stores a string in the arena. The command gets joined with spaces.
+size_t _nocc_trace_string(const char* str, nocc_darray(const char*) cmd) {
+    size_t offset = nocc_da_size(_nocc_trace.strings);
+    if(str) nocc_str_push_cstr(_nocc_trace.strings, str);
+    for(size_t i = 0; cmd && i < nocc_da_size(cmd); i++) {
+        if(i > 0) nocc_str_push_char(_nocc_trace.strings, ' ');
+        nocc_str_push_cstr(_nocc_trace.strings, cmd[i]);
+    }
+    nocc_str_push_null(_nocc_trace.strings);
+    return offset;
+}
+
+void _nocc_trace_event_push(const char* category, size_t name, size_t args, size_t slot, int64_t start, int64_t end) {
+    _nocc_trace_event event = { .category = category, .name = name, .args = args, .slot = slot, .start = start, .end = end };
+    nocc_da_push(_nocc_trace.events, event);
+    if(slot > _nocc_trace.slots) _nocc_trace.slots = slot;
+}
+
+/**
+ * @brief Records something nocc did between `start` and now, on its own row of the trace.
+ * 
+ * @param {const char*} category -- a string literal, e.g. "scan" or "stale"
+ * @param {const char*} name -- what it was done to
+ * @param {int64_t} start -- nocc_now_ns() when it started
+ * 
+ * @return {void}
+*/
+void nocc_trace_span(const char* category, const char* name, int64_t start) {
+    if(!nocc_tracing()) return;
+    _nocc_trace_event_push(category, _nocc_trace_string(name, NULL), SIZE_MAX, 0, start, nocc_now_ns());
+}
+
+void _nocc_trace_write_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for(const unsigned char* it = (const unsigned char*)str; *it; it++) {
+        if(*it == '"' || *it == '\\') fprintf(file, "\\%c", *it);
+        else if(*it < 0x20)           fprintf(file, "\\u%04x", *it);
+        else                          fputc(*it, file);
+    }
+    fputc('"', file);
+}
+
+/**
+ * @brief Writes the recorded events to the path given to nocc_trace_enable and stops recording.
+ * Runs at exit on its own, call it earlier to get the trace of a process that does not exit (e.g. watch mode).
+ * 
+ * @return {void}
+*/
+void nocc_trace_write(void) {
+    if(!nocc_tracing()) return;
+
+    FILE* file = fopen(_nocc_trace.path, "wb");
+    if(file == NULL) {
+        nocc_error("Could not write the trace %s: %s", _nocc_trace.path, strerror(errno));
+    } else {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"thread_name\",\"args\":{\"name\":\"nocc\"}}");
+        for(size_t i = 1; i <= _nocc_trace.slots; i++) {
+            fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"name\":\"thread_name\",\"args\":{\"name\":\"job %zu\"}}", i, i - 1);
+        }
+
+        for(size_t i = 0; i < nocc_da_size(_nocc_trace.events); i++) {
+            _nocc_trace_event* event = &_nocc_trace.events[i];
+            // The format counts in microseconds
+            fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"cat\":\"%s\",\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                    event->slot, event->category, (double)(event->start - _nocc_trace.epoch) / 1e3, (double)(event->end - event->start) / 1e3);
+            _nocc_trace_write_string(file, _nocc_trace.strings + event->name);
+            if(event->args != SIZE_MAX) {
+                fprintf(file, ",\"args\":{\"cmd\":");
+                _nocc_trace_write_string(file, _nocc_trace.strings + event->args);
+                fprintf(file, "}");
+            }
+            fprintf(file, "}");
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+    }
+
+    free(_nocc_trace.path);
+    nocc_da_free(_nocc_trace.events);
+    nocc_str_free(_nocc_trace.strings);
+    _nocc_trace = (_nocc_trace_t){0};
+}
+
+// Trace End ==============================================================
+
 // File Begins ============================================================
 
 typedef enum {
@@ -522,9 +847,19 @@ typedef enum {
     NOCC_FT_FILE
 } nocc_file_type;
 
-nocc_file_type _nocc_get_file_type(const char* filepath);
-bool _nocc_read_dir_single_dir(const char* src_dir, const char*** files);
-char* _nocc_get_basename(const char* dir, char* output);
+// A symbolic link in a directory listing. What it points to is resolved on every scan, the target can change
+// without the mtime of the directory holding the link changing.
+#define _NOCC_FT_LINK   ((nocc_file_type)3)
+
+// One entry of a directory, the name is an offset into the names the directory was read into
+typedef struct {
+    size_t name;
+    nocc_file_type type;
+} _nocc_dir_entry;
+
+bool _nocc_read_dir_single_dir(const char* src_dir, nocc_string* names, nocc_darray(_nocc_dir_entry)* entries);
+typedef struct nocc_filter nocc_filter;
+bool _nocc_read_dir_parallel(const char* src_dir, const nocc_filter* filter, const char*** files);
 
 // dirent.h =====================================================================
 /**
@@ -554,21 +889,47 @@ char *basename(const char* path, char* basename_out);
 #endif
 // dirent.h =====================================================================
 
+void nocc_stat_cache_invalidate(const char* filepath);
+
+bool _nocc_is_separator(char c) {
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif // _WIN32
+}
+
+int _nocc_mkdir(const char* dirname) {
+#ifdef _WIN32
+    return _mkdir(dirname);
+#else
+    return mkdir(dirname, 0777);
+#endif
+}
+
 /**
- * Creates a directory if the folder does note exist
+ * Creates a directory if the folder does note exist, and the parent directories it needs (like mkdir -p)
  * 
  * @param {const char*} dirname -- the directory name to create.
  * @return {bool} return's false if the directory wasn't created, however, if it exists it returns true.
- * 
- * TODO: Make this recursive... No idea how.
  */
 bool nocc_mkdir_if_not_exists(const char* dirname) {
-    int status;
-#ifdef _WIN32
-    status = _mkdir(dirname);
-#else
-    status = mkdir(dirname, 0x777);
-#endif
+    int status = _nocc_mkdir(dirname);
+    if(status == -1 && errno == ENOENT) {
+        size_t length = strlen(dirname);
+        while(length > 0 && !_nocc_is_separator(dirname[length - 1])) length--;
+        while(length > 0 && _nocc_is_separator(dirname[length - 1])) length--;
+
+        if(length > 0) {
+            char* parent = malloc(length + 1);
+            memcpy(parent, dirname, length);
+            parent[length] = '\0';
+            bool created = nocc_mkdir_if_not_exists(parent);
+            free(parent);
+            if(created) status = _nocc_mkdir(dirname);
+        }
+    }
+
     if(status == -1) {
         if(errno == EEXIST) {
             nocc_trace("Dir %s", dirname);
@@ -577,337 +938,5497 @@ bool nocc_mkdir_if_not_exists(const char* dirname) {
         nocc_error("Failed to create dir %s: %s", dirname, strerror(errno));
         return false;
     }
+    nocc_stat_cache_invalidate(dirname);
     return true;
-
 }
 
-/**
- * Recursively obtain all source files
- * 
- * @param {const char*} src_dir -- the directory to obtain all source files from
- * @param {const char*} file_extension -- the file extension to keep
- * @param {const char**} files  -- the files in the directory
- *  
- * @return {boolean}
- */
-bool nocc_read_dir(const char* src_dir, const char* file_extension, const char*** array_of_files_out) {
-    nocc_darray(const char*) array_of_files_in_cwd = nocc_da_create(const char*);
-    _nocc_read_dir_single_dir(src_dir, &array_of_files_in_cwd);
-    for(size_t i = 0; i < nocc_da_size(array_of_files_in_cwd); i++) {
-        if(strcmp(array_of_files_in_cwd[i], ".") == 0)  continue;
-        if(strcmp(array_of_files_in_cwd[i], "..") == 0) continue;
+typedef enum {
+    _NOCC_GLOB_LITERAL,             // "bin"
+    _NOCC_GLOB_SUFFIX,              // "*.c"
+    _NOCC_GLOB_PREFIX,              // "test_*"
+    _NOCC_GLOB_WILDCARD             // anything else, goes through _nocc_glob_match
+} _nocc_glob_kind;
 
-        // TODO: Need a better way of dealing with this.
-        nocc_string dir = nocc_str_create();
-        nocc_str_push_cstr(dir, src_dir);
-        nocc_str_push_char(dir, '/');
-        nocc_str_push_cstr(dir, array_of_files_in_cwd[i]);
-        nocc_str_push_null(dir);
+typedef struct {
+    _nocc_glob_kind kind;
+    char* text;                     // without the '*' for suffixes and prefixes
+    size_t length;
+    bool path;                      // has a '/', matched against the path from the scanned directory instead of the name
+    bool dir_only;                  // ended in a '/'
+} _nocc_glob;
 
-        nocc_file_type type = _nocc_get_file_type(dir);
-        switch (type)
-        {
-        case NOCC_FT_FILE:
-            // Step 1 get the file extension
-            // TODO: Refactor this code out of the funciton
-            char* it = dir + 1;
-            for(; it != '\0'; it++) {
-                if(*it == '.') {
-                    it++;
-                    break;
-                }
-            }
+/**
+ * @brief Decides which files nocc_read_dir_filtered keeps. Patterns are globs: '*' matches anything but a '/', "**" anything,
+ * '?' a single character. A pattern without a '/' is matched against the name (at any depth), one with a '/' against the path
+ * below the scanned directory (e.g. "tests/unit_?.c"), and one ending in a '/' only matches directories.
+ * Excluded directories are not even opened. Without include patterns every file that is not excluded is kept.
+ * The patterns are compiled when they are added, most turn into a plain compare.
+*/
+struct nocc_filter {
+    nocc_darray(_nocc_glob) include;
+    nocc_darray(_nocc_glob) exclude;
+};
 
-            if(strcmp(it, file_extension) == 0) {
-                nocc_da_push(*array_of_files_out, strdup(dir));
-            }
-            break;
+void nocc_filter_init(nocc_filter* filter) {
+    filter->include = nocc_da_create(_nocc_glob);
+    filter->exclude = nocc_da_create(_nocc_glob);
+}
 
-        case NOCC_FT_DIRECTORY:
-            nocc_read_dir(dir, file_extension, array_of_files_out);
-            break;
+void nocc_filter_free(nocc_filter* filter) {
+    for(size_t i = 0; i < nocc_da_size(filter->include); i++) free(filter->include[i].text);
+    for(size_t i = 0; i < nocc_da_size(filter->exclude); i++) free(filter->exclude[i].text);
+    nocc_da_free(filter->include);
+    nocc_da_free(filter->exclude);
+}
 
-        case NOCC_FT_UNKNOWN:
-        default:
-            break;
-        }
+_nocc_glob _nocc_glob_compile(const char* pattern) {
+    _nocc_glob glob = {0};
+    // "/bin" is the same as "bin/.." would be, it only matches at the top
+    if(pattern[0] == '/') {
+        pattern++;
+        glob.path = true;
+    }
 
-        nocc_str_free(dir);
+    size_t length = strlen(pattern);
+    if(length > 0 && pattern[length - 1] == '/') {
+        glob.dir_only = true;
+        length--;
+    }
 
+    size_t stars = 0;
+    bool wildcard = false;
+    for(size_t i = 0; i < length; i++) {
+        if(pattern[i] == '/') glob.path = true;
+        if(pattern[i] == '*') stars++;
+        if(pattern[i] == '?') wildcard = true;
     }
-    nocc_da_free(array_of_files_in_cwd);
-    return true;
-}
 
-nocc_string _nocc_generate_object_file(const char* filename, const char* fmt, ...) {
-    nocc_string obj_file = nocc_str_create();
-    va_list args;
-    va_start(args, fmt);
+    size_t start = 0;
+    if(stars == 0 && !wildcard) {
+        glob.kind = _NOCC_GLOB_LITERAL;
+    } else if(stars == 1 && !wildcard && pattern[0] == '*' && !glob.path) {
+        glob.kind = _NOCC_GLOB_SUFFIX;
+        start = 1;
+    } else if(stars == 1 && !wildcard && pattern[length - 1] == '*' && !glob.path) {
+        glob.kind = _NOCC_GLOB_PREFIX;
+        length--;
+    } else {
+        glob.kind = _NOCC_GLOB_WILDCARD;
+    }
 
-    for(const char* it = fmt; *it != '\0'; it++) {
-        if(*it != '%') {
-            nocc_str_push_char(obj_file, *it);
-            continue;
-        }
-    
-        it++;
+    glob.length = length - start;
+    glob.text = malloc(glob.length + 1);
+    memcpy(glob.text, pattern + start, glob.length);
+    glob.text[glob.length] = '\0';
+    return glob;
+}
 
-        switch(*it) {
-        case 'n':
-            char base_name[1024] = "";
-            _nocc_get_basename(filename, base_name);
-            nocc_str_push_cstr(obj_file, base_name);
-            break;
+bool _nocc_glob_match(const char* pattern, const char* str) {
+    while(*pattern) {
+        if(pattern[0] == '*' && pattern[1] == '*') {
+            pattern += 2;
+            // A "**" followed by a '/' can also stand for no directory at all, the rest has to match from the start of one
+            if(*pattern == '/') {
+                pattern++;
+                for(;;) {
+                    if(_nocc_glob_match(pattern, str)) return true;
+                    str = strchr(str, '/');
+                    if(str == NULL) return false;
+                    str++;
+                }
+            }
+            for(;; str++) {
+                if(_nocc_glob_match(pattern, str)) return true;
+                if(*str == '\0') return false;
+            }
+        }
+        if(*pattern == '*') {
+            pattern++;
+            for(;; str++) {
+                if(_nocc_glob_match(pattern, str)) return true;
+                if(*str == '\0' || *str == '/') return false;
+            }
+        }
 
-        case 's':
-            const char* string = va_arg(args, const char*);
-            nocc_str_push_cstr(obj_file, string);
-            break;
-        case '%':
-            nocc_str_push_char(obj_file, *it);
-            break;
-        default:
-            break;
+        if(*str == '\0') return false;
+        if(*pattern == '?') {
+            if(*str == '/') return false;
+        } else if(*pattern != *str) {
+            return false;
         }
+        pattern++;
+        str++;
     }
-    nocc_str_push_null(obj_file);
+    return *str == '\0';
+}
 
-    va_end(args);
-    return obj_file;
+bool _nocc_glob_matches(const _nocc_glob* glob, const char* path, const char* name, size_t name_length, bool is_dir) {
+    if(glob->dir_only && !is_dir) return false;
+    const char* str = glob->path ? path : name;
+    size_t length = glob->path ? strlen(path) : name_length;
+
+    switch(glob->kind) {
+    case _NOCC_GLOB_LITERAL:    return length == glob->length && memcmp(str, glob->text, length) == 0;
+    case _NOCC_GLOB_SUFFIX:     return length >= glob->length && memcmp(str + length - glob->length, glob->text, glob->length) == 0;
+    case _NOCC_GLOB_PREFIX:     return length >= glob->length && memcmp(str, glob->text, glob->length) == 0;
+    case _NOCC_GLOB_WILDCARD:   return _nocc_glob_match(glob->text, str);
+    }
+    return false;
 }
 
 /**
- * If you used Makefile then it's the patsubst function
+ * @brief Keeps the files matching the pattern, e.g. "*.c". Call it once per extension to keep several.
  * 
- * fmt:
- *  %n -- The name of the file. The name is automatically deduced from the array of files.
- * 
- * @brief generates the object files based on format specified.
+ * @param {nocc_filter*} filter -- the filter
+ * @param {const char*} pattern -- the glob
  * 
- * @param {nocc_darray(nocc_string)} array_of_object_files
- * @param {nocc_darray(const char*)} array_of_source_files
- * @param {const char*} fmt -- the filepathname
+ * @return {void}
+*/
+void nocc_filter_include(nocc_filter* filter, const char* pattern) {
+    _nocc_glob glob = _nocc_glob_compile(pattern);
+    nocc_da_push(filter->include, glob);
+}
+
+/**
+ * @brief Skips the files and directories matching the pattern, e.g. ".git", "bin/" or "third_party/tests".
  * 
- * @return {bool} true if successfully generated the object file names
+ * @param {nocc_filter*} filter -- the filter
+ * @param {const char*} pattern -- the glob
  * 
+ * @return {void}
 */
-#define nocc_generate_object_files(array_of_object_files, array_of_source_files, fmt, ...) {                                    \
-    array_of_object_files = nocc_da_reserve(nocc_string, nocc_da_size(array_of_source_files));                                  \
-    for(size_t i = 0; i < nocc_da_size(array_of_source_files); i++) {                                                           \
-        nocc_string obj_file = _nocc_generate_object_file(array_of_source_files[i], fmt, ##__VA_ARGS__);                        \
-        nocc_da_push(array_of_object_files, obj_file);                                                                          \
-    }                                                                                                                           \
+void nocc_filter_exclude(nocc_filter* filter, const char* pattern) {
+    _nocc_glob glob = _nocc_glob_compile(pattern);
+    nocc_da_push(filter->exclude, glob);
 }
 
-// Command Begin
-#define nocc_cmd_add(cmd, ...)          nocc_da_pushn(cmd, sizeof((const char*[]){__VA_ARGS__}) / sizeof(const char*), ((const char*[]){__VA_ARGS__}))
-#define nocc_cmd_addn(cmd, n, a)        nocc_da_pushn(cmd, n, a)
-
-#ifdef _WIN32
-    typedef HANDLE pid;
-#else // _WIN32
-    typedef pid_t pid;
-#endif // _WIN32
-
-void _nocc_cmd_pid_wait(pid pid) {
-#ifdef _WIN32
-    DWORD result = WaitForSingleObject(pid, INFINITE);
+/**
+ * @brief Whether the filter keeps an entry. For directories this is whether they are descended into.
+ * 
+ * @param {const nocc_filter*} filter -- the filter
+ * @param {const char*} path -- the path below the scanned directory, e.g. "src/a.c"
+ * @param {bool} is_dir -- whether the entry is a directory
+ * 
+ * @return {bool}
+*/
+bool nocc_filter_keeps(const nocc_filter* filter, const char* path, bool is_dir) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    size_t name_length = strlen(name);
 
-    if(result == WAIT_FAILED) {
-        nocc_assert(false, "Could not wait for child process %s", GetLastError());
-        return;
+    for(size_t i = 0; i < nocc_da_size(filter->exclude); i++) {
+        if(_nocc_glob_matches(&filter->exclude[i], path, name, name_length, is_dir)) return false;
     }
+    if(is_dir || nocc_da_size(filter->include) == 0) return true;
 
-    DWORD exit_code;
-    if(GetExitCodeProcess(pid, &exit_code) == 0) {
-        nocc_assert(false, "Could not get the exit code %lu", GetLastError());
-        return;
+    for(size_t i = 0; i < nocc_da_size(filter->include); i++) {
+        if(_nocc_glob_matches(&filter->include[i], path, name, name_length, is_dir)) return true;
     }
+    return false;
+}
 
-    if(exit_code != 0) {
-        nocc_assert(false, "Exit code recieved %d", exit_code);
-        return;
-    }
+#ifndef NOCC_SCAN_MAX_THREADS
+    #define NOCC_SCAN_MAX_THREADS   16
+#endif // NOCC_SCAN_MAX_THREADS
 
-    CloseHandle(pid);
-#else
-    for(;;) {
-        int wstatus = 0;
-        if(waitpid(pid, &wstatus, 0) < 0) {
-            nocc_assert(false, "Could not wait for child process %s", strerror(errno));
-            return;
-        }
+/**
+ * Recursively obtains the files the filter keeps. The subdirectories are handed out to up to NOCC_SCAN_MAX_THREADS threads
+ * (one per cpu), a thread with nothing to read sleeps until another one queues a directory. The files come out sorted.
+ * The types come from readdir (d_type), so files are not stat'ed and the stat cache is not involved,
+ * see nocc_stat_cache_begin.
+ * 
+ * @param {const char*} src_dir -- the directory to obtain the files from
+ * @param {const nocc_filter*} filter -- which files to keep and which directories to skip
+ * @param {const char**} files  -- the files in the directory, appended to what is already in there
+ *  
+ * @return {boolean} false if a directory could not be read, the files of the others are still there.
+ */
+bool nocc_read_dir_filtered(const char* src_dir, const nocc_filter* filter, const char*** array_of_files_out) {
+    int64_t trace_start = nocc_tracing() ? nocc_now_ns() : 0;
+    bool status = _nocc_read_dir_parallel(src_dir, filter, array_of_files_out);
+    nocc_trace_span("scan", src_dir, trace_start);
+    return status;
+}
 
-        if(WIFEXITED(wstatus)) {
-            int exit_code = WEXITSTATUS(wstatus);
-            if (exit_status != 0) {
-                nocc_assert(false, "Exited with exit code %d", exit_status);
-            }
+/**
+ * Recursively obtain all source files, see nocc_read_dir_filtered.
+ * 
+ * @param {const char*} src_dir -- the directory to obtain all source files from
+ * @param {const char*} file_extension -- the file extensions to keep, separated by commas e.g. "c,h,S"
+ * @param {const char**} files  -- the files in the directory, appended to what is already in there
+ *  
+ * @return {boolean} false if a directory could not be read, the files of the others are still there.
+ */
+bool nocc_read_dir(const char* src_dir, const char* file_extension, const char*** array_of_files_out) {
+    nocc_filter filter;
+    nocc_filter_init(&filter);
+
+    char pattern[256] = "*.";
+    for(const char* it = file_extension; *it != '\0';) {
+        size_t length = strcspn(it, ",");
+        if(length > 0 && length < sizeof(pattern) - 2) {
+            memcpy(pattern + 2, it, length);
+            pattern[2 + length] = '\0';
+            nocc_filter_include(&filter, pattern);
+        }
+        it += length;
+        if(*it == ',') it++;
+    }
+
+    bool status = nocc_read_dir_filtered(src_dir, &filter, array_of_files_out);
+    nocc_filter_free(&filter);
+    return status;
+}
+
+// "./src/a.c" and "src/a.c" are the same file
+const char* _nocc_path_skip_dot(const char* path) {
+    while(path[0] == '.' && (path[1] == '/' || path[1] == '\\')) path += 2;
+    return path;
+}
+
+typedef struct {
+    const char* path;
+    size_t index;
+} _nocc_path_slot;
+
+int _nocc_path_slot_compare(const void* a, const void* b) {
+    const _nocc_path_slot* x = a;
+    const _nocc_path_slot* y = b;
+    int order = strcmp(_nocc_path_skip_dot(x->path), _nocc_path_skip_dot(y->path));
+    if(order != 0) return order;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// Drops the paths from `first` on that are already in the array, "./a.c" and "a.c" count as the same. The order is kept.
+void _nocc_paths_unique(nocc_darray(const char*) paths, size_t first) {
+    size_t count = nocc_da_size(paths);
+    if(count < 2 || first >= count) return;
+
+    _nocc_path_slot* slots = malloc(count * sizeof(_nocc_path_slot));
+    bool* drop = calloc(count, sizeof(bool));
+    for(size_t i = 0; i < count; i++) slots[i] = (_nocc_path_slot){ paths[i], i };
+    qsort(slots, count, sizeof(_nocc_path_slot), _nocc_path_slot_compare);
+    for(size_t i = 1; i < count; i++) {
+        bool same = strcmp(_nocc_path_skip_dot(slots[i - 1].path), _nocc_path_skip_dot(slots[i].path)) == 0;
+        if(same && slots[i].index >= first) drop[slots[i].index] = true;
+    }
+
+    size_t unique = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!drop[i]) paths[unique++] = paths[i];
+    }
+    while(nocc_da_size(paths) > unique) nocc_da_remove(paths, nocc_da_size(paths) - 1, NULL);
+
+    free(drop);
+    free(slots);
+}
+
+/**
+ * @brief The modification time of a file in nanoseconds, so edits within the same second are not missed.
+*/
+typedef int64_t nocc_file_time;
+
+typedef struct {
+    bool exists;
+    nocc_file_type type;
+    nocc_file_time mtime;
+    uint64_t size;
+} nocc_file_info;
+
+uint64_t nocc_hash(const void* data, size_t size, uint64_t seed);
+
+// One build asks for the same paths over and over (every staleness check of every target, the build database, the object cache),
+// the stat cache answers them from memory for as long as it is active. Directory scans do not need it, see nocc_read_dir_filtered.
+typedef struct {
+    uint64_t key;           // 0 marks an empty slot
+    char* path;
+    nocc_file_info info;
+} _nocc_stat_entry;
+
+typedef struct {
+    size_t depth;
+    _nocc_stat_entry* entries;
+    size_t capacity, size;
+} _nocc_stat_cache_t;
+
+static _nocc_stat_cache_t _nocc_stat_cache = {0};
+
+uint64_t _nocc_stat_key(const char* filepath) {
+    filepath = _nocc_path_skip_dot(filepath);
+    uint64_t key = nocc_hash(filepath, strlen(filepath), 0);
+    return key == 0 ? 1 : key;
+}
+
+_nocc_stat_entry* _nocc_stat_cache_find(uint64_t key, const char* filepath, bool insert) {
+    if(insert && (_nocc_stat_cache.size + 1) * 4 >= _nocc_stat_cache.capacity * 3) {
+        size_t old_capacity = _nocc_stat_cache.capacity;
+        _nocc_stat_entry* old = _nocc_stat_cache.entries;
+
+        _nocc_stat_cache.capacity = old_capacity ? old_capacity * 2 : 256;
+        _nocc_stat_cache.entries = calloc(_nocc_stat_cache.capacity, sizeof(_nocc_stat_entry));
+        for(size_t i = 0; i < old_capacity; i++) {
+            if(old[i].key == 0) continue;
+            size_t mask = _nocc_stat_cache.capacity - 1;
+            size_t j = old[i].key & mask;
+            while(_nocc_stat_cache.entries[j].key != 0) j = (j + 1) & mask;
+            _nocc_stat_cache.entries[j] = old[i];
+        }
+        free(old);
+    }
+    if(_nocc_stat_cache.capacity == 0) return NULL;
+
+    filepath = _nocc_path_skip_dot(filepath);
+    size_t mask = _nocc_stat_cache.capacity - 1;
+    for(size_t i = key & mask;; i = (i + 1) & mask) {
+        _nocc_stat_entry* entry = &_nocc_stat_cache.entries[i];
+        if(entry->key == key && strcmp(entry->path, filepath) == 0) return entry;
+        if(entry->key == 0) {
+            if(!insert) return NULL;
+            entry->key = key;
+            entry->path = strdup(filepath);
+            _nocc_stat_cache.size++;
+            return entry;
+        }
+    }
+}
+
+void _nocc_stat_cache_clear(void) {
+    for(size_t i = 0; i < _nocc_stat_cache.capacity; i++) {
+        free(_nocc_stat_cache.entries[i].path);
+    }
+    free(_nocc_stat_cache.entries);
+    _nocc_stat_cache.entries = NULL;
+    _nocc_stat_cache.capacity = _nocc_stat_cache.size = 0;
+}
+
+/**
+ * @brief Starts caching file queries (stat) by path. Calls nest, the cache is dropped when the outermost
+ * nocc_stat_cache_end is reached. nocc_graph_build does this for the duration of the build, nocc_serve for as long
+ * as it runs (dropping what the watcher reports as changed).
+ * Every file query of nocc goes through it, except the directory scanner: it learns the type of an entry from readdir
+ * without a stat, only stats symlinks and entries of unknown type (relative to the directory, on its worker threads),
+ * and the directories themselves only for the directory cache, which needs their current state.
+ * 
+ * @return {void}
+*/
+void nocc_stat_cache_begin(void) {
+    _nocc_stat_cache.depth++;
+}
+
+/**
+ * @brief Ends a nocc_stat_cache_begin.
+ * 
+ * @return {void}
+*/
+void nocc_stat_cache_end(void) {
+    nocc_assert(_nocc_stat_cache.depth > 0, "nocc_stat_cache_end without nocc_stat_cache_begin");
+    if(_nocc_stat_cache.depth == 0 || --_nocc_stat_cache.depth > 0) return;
+    _nocc_stat_cache_clear();
+}
+
+/**
+ * @brief Forgets what the cache knows about the path, call it after writing to a file.
+ * nocc does this itself for the outputs of the commands it runs.
+ * 
+ * @param {const char*} filepath -- The path
+ * 
+ * @return {void}
+*/
+void nocc_stat_cache_invalidate(const char* filepath) {
+    if(_nocc_stat_cache.capacity == 0) return;
+
+    // Backward shift deletion, so the probe sequences of the other entries stay intact
+    size_t mask = _nocc_stat_cache.capacity - 1;
+    _nocc_stat_entry* entry = _nocc_stat_cache_find(_nocc_stat_key(filepath), filepath, false);
+    if(entry == NULL) return;
+
+    size_t hole = (size_t)(entry - _nocc_stat_cache.entries);
+    free(entry->path);
+    for(size_t i = (hole + 1) & mask; _nocc_stat_cache.entries[i].key != 0; i = (i + 1) & mask) {
+        size_t home = _nocc_stat_cache.entries[i].key & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            _nocc_stat_cache.entries[hole] = _nocc_stat_cache.entries[i];
+            hole = i;
+        }
+    }
+    memset(&_nocc_stat_cache.entries[hole], 0, sizeof(_nocc_stat_entry));
+    _nocc_stat_cache.size--;
+}
+
+bool _nocc_stat_uncached(const char* filepath, nocc_file_info* info) {
+    memset(info, 0, sizeof(*info));
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if(!GetFileAttributesExA(filepath, GetFileExInfoStandard, &data)) {
+        DWORD error = GetLastError();
+        errno = (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) ? ENOENT : EIO;
+        return false;
+    }
+
+    // FILETIME counts 100 nanosecond ticks
+    uint64_t ticks = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    info->mtime = (nocc_file_time)(ticks * 100);
+    info->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    info->type = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? NOCC_FT_DIRECTORY : NOCC_FT_FILE;
+#else
+    struct stat statbuf;
+    if(stat(filepath, &statbuf) < 0) return false;
+
+#ifdef __APPLE__
+    info->mtime = (nocc_file_time)statbuf.st_mtimespec.tv_sec * 1000000000 + statbuf.st_mtimespec.tv_nsec;
+#else
+    info->mtime = (nocc_file_time)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+#endif // __APPLE__
+    info->size = (uint64_t)statbuf.st_size;
+    switch (statbuf.st_mode & S_IFMT) {
+        case S_IFDIR:  info->type = NOCC_FT_DIRECTORY; break;
+        case S_IFREG:  info->type = NOCC_FT_FILE; break;
+        default:       info->type = NOCC_FT_UNKNOWN; break;
+    }
+#endif // _WIN32
+    info->exists = true;
+    return true;
+}
+
+/**
+ * @brief Gets the type, modification time and size of the file, from the stat cache if it is active.
+ * 
+ * @param {const char*} filepath -- the file
+ * @param {nocc_file_info*} info -- receives the information
+ * 
+ * @return {bool} false if the file does not exist or could not be queried, errno is ENOENT if it does not exist.
+*/
+bool nocc_get_file_info(const char* filepath, nocc_file_info* info) {
+    if(_nocc_stat_cache.depth == 0) return _nocc_stat_uncached(filepath, info);
+
+    uint64_t key = _nocc_stat_key(filepath);
+    _nocc_stat_entry* entry = _nocc_stat_cache_find(key, filepath, false);
+    if(entry == NULL) {
+        bool status = _nocc_stat_uncached(filepath, info);
+        // Missing files are remembered as well, anything else is an error worth retrying
+        if(!status && errno != ENOENT) return false;
+        entry = _nocc_stat_cache_find(key, filepath, true);
+        entry->info = *info;
+    }
+
+    *info = entry->info;
+    if(!info->exists) errno = ENOENT;
+    return info->exists;
+}
+
+/**
+ * @brief Gets the modification time and size of the file.
+ * 
+ * @param {const char*} filepath -- the file
+ * @param {nocc_file_time*} mtime_out -- the modification time in nanoseconds
+ * @param {uint64_t*} size_out -- (optional) the size of the file
+ * 
+ * @return {bool} false if the file does not exist or could not be queried, errno is ENOENT if it does not exist.
+*/
+bool nocc_get_file_time(const char* filepath, nocc_file_time* mtime_out, uint64_t* size_out) {
+    nocc_file_info info;
+    if(!nocc_get_file_info(filepath, &info)) return false;
+
+    *mtime_out = info.mtime;
+    if(size_out) *size_out = info.size;
+    return true;
+}
+
+// The wall clock, in the unit and epoch of the mtimes
+nocc_file_time _nocc_file_time_now(void) {
+#ifdef _WIN32
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    return (nocc_file_time)((((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime) * 100);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (nocc_file_time)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif // _WIN32
+}
+
+/**
+ * @brief Reads the whole file into a single heap buffer. The buffer is NULL terminated, so it can be parsed in place.
+ * 
+ * @param {const char*} filepath -- the file to read
+ * @param {size_t*} size_out -- (optional) the size of the file, without the terminator
+ * 
+ * @return {char*} the contents, which the caller frees, or NULL if the file could not be read.
+*/
+char* nocc_read_entire_file(const char* filepath, size_t* size_out) {
+    FILE* file = fopen(filepath, "rb");
+    if(file == NULL) return NULL;
+
+    char* data = NULL;
+    long size = 0;
+    if(fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) goto done;
+
+    data = malloc((size_t)size + 1);
+    if(data == NULL) goto done;
+    if(fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+        goto done;
+    }
+    data[size] = '\0';
+    if(size_out) *size_out = (size_t)size;
+
+done:
+    fclose(file);
+    return data;
+}
+
+int _nocc_compare_strings(const void* a, const void* b) {
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+/**
+ * @brief Creates the directories the files go into (e.g. the outputs of a build), each one once. The directories are
+ * sorted first, so a parent is always handled before its children, and one that already exists costs a (cached) stat.
+ * nocc_graph_build does this for the outputs of every target before the first command runs.
+ * 
+ * @param {const char**} files -- the files
+ * @param {size_t} files_size -- the amount of files
+ * 
+ * @return {bool} false if a directory could not be created.
+*/
+bool nocc_mkdir_parents(const char** files, size_t files_size) {
+    nocc_darray(char*) dirs = nocc_da_reserve(char*, files_size + 1);
+    for(size_t i = 0; i < files_size; i++) {
+        size_t length = strlen(files[i]);
+        while(length > 0 && !_nocc_is_separator(files[i][length - 1])) length--;
+        while(length > 0 && _nocc_is_separator(files[i][length - 1])) length--;
+        if(length == 0) continue;
+
+        char* dir = malloc(length + 1);
+        memcpy(dir, files[i], length);
+        dir[length] = '\0';
+        nocc_da_push(dirs, dir);
+    }
+    qsort(dirs, nocc_da_size(dirs), sizeof(char*), _nocc_compare_strings);
+
+    bool status = true;
+    for(size_t i = 0; i < nocc_da_size(dirs); i++) {
+        if(i > 0 && strcmp(dirs[i], dirs[i - 1]) == 0) continue;
+
+        nocc_file_info info;
+        if(nocc_get_file_info(dirs[i], &info) && info.type == NOCC_FT_DIRECTORY) continue;
+        if(!nocc_mkdir_if_not_exists(dirs[i])) status = false;
+    }
+
+    for(size_t i = 0; i < nocc_da_size(dirs); i++) free(dirs[i]);
+    nocc_da_free(dirs);
+    return status;
+}
+
+nocc_string _nocc_generate_object_file(const char* filename, const char* fmt, ...) {
+    nocc_string obj_file = nocc_str_create();
+    va_list args;
+    va_start(args, fmt);
+
+    // "src/net/a.c" is split into "src/net" and "a.c"
+    const char* name = filename;
+    for(const char* it = filename; *it != '\0'; it++) {
+        if(_nocc_is_separator(*it)) name = it + 1;
+    }
+
+    for(const char* it = fmt; *it != '\0'; it++) {
+        if(*it != '%') {
+            nocc_str_push_char(obj_file, *it);
+            continue;
+        }
+    
+        it++;
+
+        switch(*it) {
+        case 'n': {
+#ifdef _WIN32
+            // Windows has always dropped the extension here
+            const char* dot = name[0] != '\0' ? strchr(name + 1, '.') : NULL;
+            size_t length = dot ? (size_t)(dot - name) : strlen(name);
+            nocc_da_pushn(obj_file, length, (void*)name);
+#else
+            nocc_str_push_cstr(obj_file, name);
+#endif // _WIN32
+            break;
+        }
+
+        case 'b': {
+            const char* dot = strrchr(name, '.');
+            size_t length = (dot && dot != name) ? (size_t)(dot - name) : strlen(name);
+            nocc_da_pushn(obj_file, length, (void*)name);
+            break;
+        }
+
+        case 'p': {
+            // The directory of the source below the build directory. ".." and the root become "@up" and "@root" so they can
+            // not lead out of it, a real directory starting with '@' gets another one, so no two directories end up the same.
+            size_t before = nocc_da_size(obj_file);
+            const char* component = filename;
+            if(component < name && _nocc_is_separator(*component)) nocc_str_push_cstr(obj_file, "@root");
+            while(component < name) {
+                const char* end = component;
+                while(end < name && !_nocc_is_separator(*end)) end++;
+                size_t length = (size_t)(end - component);
+
+                if(length > 0 && !(length == 1 && component[0] == '.')) {
+                    if(nocc_da_size(obj_file) > before) nocc_str_push_char(obj_file, '/');
+                    if(length == 2 && component[0] == '.' && component[1] == '.') {
+                        nocc_str_push_cstr(obj_file, "@up");
+#ifdef _WIN32
+                    } else if(component == filename && length == 2 && component[1] == ':') {
+                        // "C:"
+                        nocc_str_push_char(obj_file, '@');
+                        nocc_str_push_char(obj_file, component[0]);
+#endif // _WIN32
+                    } else {
+                        if(component[0] == '@') nocc_str_push_char(obj_file, '@');
+                        nocc_da_pushn(obj_file, length, (void*)component);
+                    }
+                }
+                component = end + 1;
+            }
+            // A source at the top leaves no empty directory behind
+            if(nocc_da_size(obj_file) == before && it[1] == '/') it++;
+            break;
+        }
+
+        case 's':
+            const char* string = va_arg(args, const char*);
+            nocc_str_push_cstr(obj_file, string);
+            break;
+        case '%':
+            nocc_str_push_char(obj_file, *it);
+            break;
+        default:
+            break;
+        }
+    }
+    nocc_str_push_null(obj_file);
+
+    va_end(args);
+    return obj_file;
+}
+
+typedef struct {
+    const char* object;
+    const char* source;
+} _nocc_object_pair;
+
+int _nocc_object_pair_compare(const void* a, const void* b) {
+    return strcmp(((const _nocc_object_pair*)a)->object, ((const _nocc_object_pair*)b)->object);
+}
+
+// Two sources compiled into the same object would overwrite each other, e.g. "src/a.c" and "lib/a.c" with "%s/%b.o"
+bool _nocc_check_object_files(nocc_darray(nocc_string) objects, const char** sources) {
+    size_t count = nocc_da_size(objects);
+    nocc_darray(_nocc_object_pair) pairs = nocc_da_reserve(_nocc_object_pair, count + 1);
+    for(size_t i = 0; i < count; i++) {
+        _nocc_object_pair pair = { .object = objects[i], .source = sources[i] };
+        nocc_da_push(pairs, pair);
+    }
+    qsort(pairs, count, sizeof(_nocc_object_pair), _nocc_object_pair_compare);
+
+    bool status = true;
+    for(size_t i = 1; i < count; i++) {
+        if(strcmp(pairs[i].object, pairs[i - 1].object) != 0) continue;
+        // The same source listed twice is fine
+        if(strcmp(_nocc_path_skip_dot(pairs[i].source), _nocc_path_skip_dot(pairs[i - 1].source)) == 0) continue;
+        nocc_error("%s and %s both compile to %s, add %%p to the pattern", pairs[i - 1].source, pairs[i].source, pairs[i].object);
+        status = false;
+    }
+    nocc_da_free(pairs);
+    return status;
+}
+
+/**
+ * If you used Makefile then it's the patsubst function
+ * 
+ * fmt:
+ *  %n -- The name of the file, e.g. "a.c", on Windows without the extension ("a"). The name is automatically deduced
+ *        from the array of files. Use %b to drop the extension on every platform.
+ *  %b -- The name without its extension, e.g. "a"
+ *  %p -- The directory of the file, e.g. "src/net", so "%s/%p/%b.o" mirrors the source tree under a build directory and
+ *        sources with the same name in different directories get different objects. ".." becomes "@up" and a leading
+ *        "/" becomes "@root", so "../lib/a.c" goes to "@up/lib", a directory whose name starts with '@' gets another one.
+ *        Use nocc_mkdir_parents on the result (nocc_graph_build does) to create the directories.
+ *  %s -- The next string argument
+ * 
+ * Sources that end up with the same object file are reported with nocc_error.
+ * 
+ * @brief generates the object files based on format specified.
+ * 
+ * @param {nocc_darray(nocc_string)} array_of_object_files
+ * @param {nocc_darray(const char*)} array_of_source_files
+ * @param {const char*} fmt -- the filepathname
+ * 
+ * @return {bool} true if successfully generated the object file names
+ * 
+*/
+#define nocc_generate_object_files(array_of_object_files, array_of_source_files, fmt, ...) {                                    \
+    array_of_object_files = nocc_da_reserve(nocc_string, nocc_da_size(array_of_source_files));                                  \
+    for(size_t i = 0; i < nocc_da_size(array_of_source_files); i++) {                                                           \
+        nocc_string obj_file = _nocc_generate_object_file(array_of_source_files[i], fmt, ##__VA_ARGS__);                        \
+        nocc_da_push(array_of_object_files, obj_file);                                                                          \
+    }                                                                                                                           \
+    _nocc_check_object_files(array_of_object_files, (const char**)(array_of_source_files));                                     \
+}
+
+// Hash Begin ============================================================
+
+#define _nocc_rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/**
+ * @brief A fast non-cryptographic 64 bit hash (murmur3 style mixing, 8 bytes per step).
+ * 
+ * @param {const void*} data -- the bytes to hash
+ * @param {size_t} size -- the amount of bytes
+ * @param {uint64_t} seed -- chains hashes together, pass 0 otherwise.
+ * 
+ * @return {uint64_t}
+*/
+uint64_t nocc_hash(const void* data, size_t size, uint64_t seed) {
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+    const uint8_t* it = (const uint8_t*)data;
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+
+    for(; size >= 8; size -= 8, it += 8) {
+        uint64_t k;
+        memcpy(&k, it, 8);
+        k *= c1; k = _nocc_rotl64(k, 31); k *= c2;
+        h ^= k;
+        h = _nocc_rotl64(h, 27) * 5 + 0x52dce729;
+    }
+
+    if(size > 0) {
+        uint64_t k = 0;
+        memcpy(&k, it, size);
+        k *= c1; k = _nocc_rotl64(k, 31); k *= c2;
+        h ^= k;
+    }
+
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+#define nocc_hash_cstr(s, seed)     nocc_hash((s), strlen(s), (seed))
+
+/**
+ * @brief Hashes the contents of the file.
+ * 
+ * @param {const char*} filepath -- the file to hash
+ * @param {uint64_t*} hash_out -- the hash
+ * 
+ * @return {bool} false if the file could not be read.
+*/
+bool nocc_hash_file(const char* filepath, uint64_t* hash_out) {
+    size_t size = 0;
+    char* data = nocc_read_entire_file(filepath, &size);
+    if(data == NULL) return false;
+
+    *hash_out = nocc_hash(data, size, 0);
+    free(data);
+    return true;
+}
+
+// Hash End ==============================================================
+
+// Build Database Begin ===================================================
+
+/**
+ * @brief The signature of an input, as it was when an output was built from it.
+*/
+typedef struct {
+    uint64_t key;           // nocc_hash of the path
+    nocc_file_time mtime;   // 0 if the file changed too close to the command starting to be trusted, the hash decides then
+    uint64_t size;
+    uint64_t hash;          // content hash, 0 when content hashing is off
+    uint64_t path;          // offset of the path in the strings the input is stored with
+} nocc_db_input;
+
+/**
+ * @brief The signatures of the inputs of a command, taken right before it starts. Recording these instead of what
+ * the files look like once the command finished keeps an edit saved while it ran from passing as built.
+*/
+typedef struct {
+    nocc_file_time taken;
+    nocc_darray(nocc_db_input) inputs;      // sorted by key, the path is not set
+} nocc_db_snapshot;
+
+// The file is: magic, record count, input count, size of the strings, the records sorted by key, the inputs of every record
+// (each record's inputs sorted by key), then the paths of the inputs, NULL terminated. Everything up to the strings
+// is 8 byte aligned so lookups work straight on the mapping.
+typedef struct {
+    uint64_t key;           // nocc_hash of the output path
+    uint64_t cmd_hash;
+    int64_t duration;       // nanoseconds
+    uint32_t first_input;
+    uint32_t input_count;
+} _nocc_db_record;
+
+// A record written during this run, it shadows the one in the file until the database is saved.
+typedef struct {
+    uint64_t key;
+    uint64_t cmd_hash;
+    int64_t duration;
+    nocc_darray(nocc_db_input) inputs;
+    nocc_string paths;
+} _nocc_db_entry;
+
+// A record, either from the file or from this run
+typedef struct {
+    const nocc_db_input* inputs;
+    size_t input_count;
+    const char* strings;    // what the paths of the inputs are offsets into
+    uint64_t cmd_hash;
+    int64_t duration;
+} _nocc_db_view;
+
+typedef struct {
+    char* path;
+    bool hash_contents;
+    bool dirty;
+
+    void* mapping;
+    size_t mapping_size;
+    const _nocc_db_record* records;
+    uint64_t record_count;
+    const nocc_db_input* inputs;
+    uint64_t input_count;
+    const char* strings;
+    uint64_t strings_size;
+
+    _nocc_db_entry* entries;
+    size_t capacity, size;
+} _nocc_db_t;
+
+static _nocc_db_t _nocc_db = {0};
+
+#define _NOCC_DB_MAGIC          "NOCCDB02"
+#define _NOCC_DB_HEADER_SIZE    (8 + 3 * sizeof(uint64_t))
+// A file that changed this close to a snapshot may change again within the same timestamp tick, unnoticed
+#define _NOCC_DB_RACY_NS        (100 * 1000000LL)
+
+// "./a.c" and "a.c" are the same file, e.g. a target input and the depfile the compiler wrote for it
+uint64_t _nocc_db_key(const char* path) {
+    uint64_t key = nocc_hash_cstr(_nocc_path_skip_dot(path), 0);
+    return key == 0 ? 1 : key;
+}
+
+/**
+ * @brief Hashes a command line, the arguments are length prefixed so ("a", "bc") and ("ab", "c") differ.
+ * 
+ * @param {nocc_darray(const char*)} cmd -- The command
+ * 
+ * @return {uint64_t}
+*/
+uint64_t nocc_cmd_hash(nocc_darray(const char*) cmd) {
+    uint64_t hash = 0;
+    for(size_t i = 0; i < nocc_da_size(cmd); i++) {
+        uint64_t length = strlen(cmd[i]);
+        hash = nocc_hash(&length, sizeof(length), hash);
+        hash = nocc_hash(cmd[i], length, hash);
+    }
+    return hash;
+}
+
+const _nocc_db_record* _nocc_db_find_mapped(uint64_t key) {
+    size_t lo = 0, hi = _nocc_db.record_count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(_nocc_db.records[mid].key == key) return &_nocc_db.records[mid];
+        if(_nocc_db.records[mid].key < key) lo = mid + 1;
+        else                                 hi = mid;
+    }
+    return NULL;
+}
+
+const nocc_db_input* _nocc_db_find_input(const nocc_db_input* inputs, size_t count, uint64_t key) {
+    size_t lo = 0, hi = count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(inputs[mid].key == key) return &inputs[mid];
+        if(inputs[mid].key < key) lo = mid + 1;
+        else                      hi = mid;
+    }
+    return NULL;
+}
+
+_nocc_db_entry* _nocc_db_find_entry(uint64_t key, bool insert) {
+    if(insert && (_nocc_db.size + 1) * 4 >= _nocc_db.capacity * 3) {
+        size_t old_capacity = _nocc_db.capacity;
+        _nocc_db_entry* old = _nocc_db.entries;
+
+        _nocc_db.capacity = old_capacity ? old_capacity * 2 : 64;
+        _nocc_db.entries = calloc(_nocc_db.capacity, sizeof(_nocc_db_entry));
+        for(size_t i = 0; i < old_capacity; i++) {
+            if(old[i].key == 0) continue;
+            size_t mask = _nocc_db.capacity - 1;
+            size_t j = old[i].key & mask;
+            while(_nocc_db.entries[j].key != 0) j = (j + 1) & mask;
+            _nocc_db.entries[j] = old[i];
+        }
+        free(old);
+    }
+    if(_nocc_db.capacity == 0) return NULL;
+
+    size_t mask = _nocc_db.capacity - 1;
+    for(size_t i = key & mask;; i = (i + 1) & mask) {
+        _nocc_db_entry* entry = &_nocc_db.entries[i];
+        if(entry->key == key) return entry;
+        if(entry->key == 0) {
+            if(!insert) return NULL;
+            entry->key = key;
+            entry->inputs = nocc_da_create(nocc_db_input);
+            entry->paths = nocc_str_create();
+            _nocc_db.size++;
+            return entry;
+        }
+    }
+}
+
+// Looks the output up, the records written this run win over the ones in the file.
+bool _nocc_db_lookup(uint64_t key, _nocc_db_view* view) {
+    _nocc_db_entry* entry = _nocc_db_find_entry(key, false);
+    if(entry) {
+        view->inputs = entry->inputs;
+        view->input_count = nocc_da_size(entry->inputs);
+        view->strings = entry->paths;
+        view->cmd_hash = entry->cmd_hash;
+        view->duration = entry->duration;
+        return true;
+    }
+
+    const _nocc_db_record* record = _nocc_db_find_mapped(key);
+    if(record == NULL) return false;
+    view->inputs = _nocc_db.inputs + record->first_input;
+    view->input_count = record->input_count;
+    view->strings = _nocc_db.strings;
+    view->cmd_hash = record->cmd_hash;
+    view->duration = record->duration;
+    return true;
+}
+
+// Appends the input with its path to the record
+void _nocc_db_entry_push(_nocc_db_entry* entry, nocc_db_input input, const char* path) {
+    input.path = nocc_da_size(entry->paths);
+    nocc_str_push_cstr(entry->paths, _nocc_path_skip_dot(path));
+    nocc_str_push_null(entry->paths);
+    nocc_da_push(entry->inputs, input);
+}
+
+// Copies the record out of the file so it can be modified
+_nocc_db_entry* _nocc_db_overlay(uint64_t key) {
+    bool exists = _nocc_db_find_entry(key, false) != NULL;
+    _nocc_db_entry* entry = _nocc_db_find_entry(key, true);
+    if(exists) return entry;
+
+    const _nocc_db_record* record = _nocc_db_find_mapped(key);
+    if(record) {
+        entry->cmd_hash = record->cmd_hash;
+        entry->duration = record->duration;
+        for(uint32_t i = 0; i < record->input_count; i++) {
+            const nocc_db_input* input = &_nocc_db.inputs[record->first_input + i];
+            _nocc_db_entry_push(entry, *input, _nocc_db.strings + input->path);
+        }
+    }
+    return entry;
+}
+
+void _nocc_db_unmap(void) {
+    if(_nocc_db.mapping == NULL) return;
+#ifdef _WIN32
+    free(_nocc_db.mapping);
+#else
+    munmap(_nocc_db.mapping, _nocc_db.mapping_size);
+#endif // _WIN32
+    _nocc_db.mapping = NULL;
+    _nocc_db.records = NULL;
+    _nocc_db.inputs = NULL;
+    _nocc_db.strings = NULL;
+    _nocc_db.record_count = _nocc_db.input_count = _nocc_db.strings_size = 0;
+}
+
+/**
+ * @brief Closes the build database without saving it.
+ * 
+ * @return {void}
+*/
+void nocc_db_close(void) {
+    _nocc_db_unmap();
+    for(size_t i = 0; i < _nocc_db.capacity; i++) {
+        if(_nocc_db.entries[i].key == 0) continue;
+        nocc_da_free(_nocc_db.entries[i].inputs);
+        nocc_str_free(_nocc_db.entries[i].paths);
+    }
+    free(_nocc_db.entries);
+    free(_nocc_db.path);
+    memset(&_nocc_db, 0, sizeof(_nocc_db));
+}
+
+/**
+ * @brief Opens the build database (e.g. "./.nocc_db"). It remembers, for every output, the hash of the command that built it,
+ * the paths and signatures of its inputs (headers from the depfile included) and how long it took. A changed command then
+ * forces a rebuild, and an input that is touched but has the same content hash does not.
+ * The file is mapped, not parsed, so opening it costs one read no matter how many outputs it holds. A graph build
+ * decides whether a recorded target is up to date from it and a stat of every input, without reading depfiles.
+ * 
+ * @param {const char*} filepath -- the database, created by nocc_db_save if it does not exist.
+ * @param {bool} hash_contents -- also keep a content hash of every input, so touched but unchanged files are not rebuilt.
+ * 
+ * @return {bool} false if the file exists but is not valid, the database then starts empty.
+*/
+bool nocc_db_load(const char* filepath, bool hash_contents) {
+    nocc_db_close();
+    _nocc_db.path = strdup(filepath);
+    _nocc_db.hash_contents = hash_contents;
+
+    size_t size = 0;
+#ifdef _WIN32
+    // NOTE: Windows cannot replace a file that is mapped, which nocc_db_save has to. So it is read instead.
+    char* data = nocc_read_entire_file(filepath, &size);
+    if(data == NULL) return true;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if(fd < 0) return true;
+
+    struct stat statbuf;
+    char* data = NULL;
+    if(fstat(fd, &statbuf) == 0 && statbuf.st_size > 0) {
+        size = (size_t)statbuf.st_size;
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) data = NULL;
+    }
+    close(fd);
+    if(data == NULL) return true;
+#endif // _WIN32
+    _nocc_db.mapping = data;
+    _nocc_db.mapping_size = size;
+
+    uint64_t record_count = 0, input_count = 0, strings_size = 0;
+    bool valid = size >= _NOCC_DB_HEADER_SIZE && memcmp(data, _NOCC_DB_MAGIC, 8) == 0;
+    if(valid) {
+        memcpy(&record_count, data + 8, sizeof(uint64_t));
+        memcpy(&input_count, data + 16, sizeof(uint64_t));
+        memcpy(&strings_size, data + 24, sizeof(uint64_t));
+        valid = size == _NOCC_DB_HEADER_SIZE + record_count * sizeof(_nocc_db_record) + input_count * sizeof(nocc_db_input) + strings_size;
+    }
+    if(valid) {
+        _nocc_db.records = (const _nocc_db_record*)(data + _NOCC_DB_HEADER_SIZE);
+        _nocc_db.inputs = (const nocc_db_input*)(_nocc_db.records + record_count);
+        _nocc_db.strings = (const char*)(_nocc_db.inputs + input_count);
+        valid = strings_size == 0 || _nocc_db.strings[strings_size - 1] == '\0';
+        for(uint64_t i = 0; i < record_count && valid; i++) {
+            valid = (uint64_t)_nocc_db.records[i].first_input + _nocc_db.records[i].input_count <= input_count;
+        }
+        for(uint64_t i = 0; i < input_count && valid; i++) {
+            valid = _nocc_db.inputs[i].path < strings_size;
+        }
+    }
+    if(!valid) {
+        nocc_warn("Ignoring invalid build database %s", filepath);
+        _nocc_db_unmap();
+        return false;
+    }
+
+    _nocc_db.record_count = record_count;
+    _nocc_db.input_count = input_count;
+    _nocc_db.strings_size = strings_size;
+    return true;
+}
+
+int _nocc_db_compare_entries(const void* a, const void* b) {
+    uint64_t x = ((const _nocc_db_entry*)a)->key, y = ((const _nocc_db_entry*)b)->key;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes the database back to the file it was loaded from, if anything changed. The file is replaced atomically.
+ * 
+ * @return {bool} false if the file could not be written.
+*/
+bool nocc_db_save(void) {
+    if(_nocc_db.path == NULL || !_nocc_db.dirty) return true;
+
+    // Merge the records of this run with the untouched records of the file, sorted by key
+    nocc_darray(_nocc_db_entry) all = nocc_da_reserve(_nocc_db_entry, _nocc_db.size + _nocc_db.record_count + 1);
+    for(size_t i = 0; i < _nocc_db.capacity; i++) {
+        if(_nocc_db.entries[i].key != 0) nocc_da_push(all, _nocc_db.entries[i]);
+    }
+    for(uint64_t i = 0; i < _nocc_db.record_count; i++) {
+        const _nocc_db_record* record = &_nocc_db.records[i];
+        if(_nocc_db_find_entry(record->key, false)) continue;
+        _nocc_db_entry view = { .key = record->key, .cmd_hash = record->cmd_hash, .duration = record->duration, .inputs = NULL };
+        nocc_da_push(all, view);
+    }
+    qsort(all, nocc_da_size(all), sizeof(_nocc_db_entry), _nocc_db_compare_entries);
+
+    nocc_string tmp = nocc_str_create();
+    nocc_str_push_cstr(tmp, _nocc_db.path);
+    nocc_str_push_cstr(tmp, ".tmp");
+    nocc_str_push_null(tmp);
+
+    bool status = false;
+    FILE* file = fopen(tmp, "wb");
+    if(file == NULL) {
+        nocc_error("Could not write %s: %s", tmp, strerror(errno));
+        goto done;
+    }
+
+    uint64_t record_count = nocc_da_size(all), input_count = 0, strings_size = 0;
+    fwrite(_NOCC_DB_MAGIC, 1, 8, file);
+    fwrite(&record_count, sizeof(uint64_t), 1, file);
+    long counts_offset = ftell(file);
+    fwrite(&input_count, sizeof(uint64_t), 1, file);
+    fwrite(&strings_size, sizeof(uint64_t), 1, file);
+
+    for(size_t i = 0; i < record_count; i++) {
+        uint32_t count = all[i].inputs ? (uint32_t)nocc_da_size(all[i].inputs) : _nocc_db_find_mapped(all[i].key)->input_count;
+        _nocc_db_record record = { .key = all[i].key, .cmd_hash = all[i].cmd_hash, .duration = all[i].duration, .first_input = (uint32_t)input_count, .input_count = count };
+        fwrite(&record, sizeof(record), 1, file);
+        input_count += count;
+    }
+
+    // The paths of every record go into one table, the inputs are rebased onto it as they are written
+    nocc_string strings = nocc_str_create();
+    for(size_t i = 0; i < record_count; i++) {
+        _nocc_db_view view;
+        _nocc_db_lookup(all[i].key, &view);
+        for(size_t j = 0; j < view.input_count; j++) {
+            nocc_db_input input = view.inputs[j];
+            input.path = nocc_da_size(strings);
+            nocc_str_push_cstr(strings, view.strings + view.inputs[j].path);
+            nocc_str_push_null(strings);
+            fwrite(&input, sizeof(input), 1, file);
+        }
+    }
+    strings_size = nocc_da_size(strings);
+    fwrite(strings, 1, strings_size, file);
+    nocc_str_free(strings);
+
+    bool written = counts_offset >= 0 && fseek(file, counts_offset, SEEK_SET) == 0;
+    if(written) {
+        fwrite(&input_count, sizeof(uint64_t), 1, file);
+        fwrite(&strings_size, sizeof(uint64_t), 1, file);
+    }
+    // A short write (e.g. the disk is full) must not replace the database that is there
+    written = written && !ferror(file);
+    status = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+    status = status && MoveFileExA(tmp, _nocc_db.path, MOVEFILE_REPLACE_EXISTING);
+#else
+    status = status && rename(tmp, _nocc_db.path) == 0;
+#endif // _WIN32
+    if(status) {
+        _nocc_db.dirty = false;
+    } else {
+        nocc_error("Could not save the build database %s", _nocc_db.path);
+        remove(tmp);
+    }
+
+done:
+    nocc_str_free(tmp);
+    nocc_da_free(all);
+    return status;
+}
+
+/**
+ * @brief true if the output was built by a different command than `cmd`, or the database knows nothing about it.
+ * Always false when the database is not loaded.
+ * 
+ * @param {const char*} outputfile -- The output
+ * @param {nocc_darray(const char*)} cmd -- The command that builds it now
+ * 
+ * @return {bool}
+*/
+bool nocc_db_command_changed(const char* outputfile, nocc_darray(const char*) cmd) {
+    if(_nocc_db.path == NULL) return false;
+
+    _nocc_db_view view;
+    if(!_nocc_db_lookup(_nocc_db_key(outputfile), &view)) return true;
+    return view.cmd_hash != nocc_cmd_hash(cmd);
+}
+
+/**
+ * @brief How long the output took to build last time.
+ * 
+ * @param {const char*} outputfile -- The output
+ * 
+ * @return {int64_t} nanoseconds, or -1 if it is not known.
+*/
+int64_t nocc_db_duration(const char* outputfile) {
+    if(_nocc_db.path == NULL) return -1;
+
+    _nocc_db_view view;
+    if(!_nocc_db_lookup(_nocc_db_key(outputfile), &view)) return -1;
+    return view.duration;
+}
+
+int _nocc_db_compare_inputs(const void* a, const void* b) {
+    uint64_t x = ((const nocc_db_input*)a)->key, y = ((const nocc_db_input*)b)->key;
+    return (x > y) - (x < y);
+}
+
+// The signature of the file as it is now. A file modified after `since` (minus the racy window) gets no mtime,
+// so only its content hash can vouch for it, and with `hash` false not even that.
+bool _nocc_db_signature(const char* filepath, nocc_file_time since, bool hash, nocc_db_input* input) {
+    memset(input, 0, sizeof(*input));
+    input->key = _nocc_db_key(filepath);
+    if(!nocc_get_file_time(filepath, &input->mtime, &input->size)) return false;
+
+    bool racy = input->mtime > since - _NOCC_DB_RACY_NS;
+    if(racy) input->mtime = 0;
+    if(_nocc_db.hash_contents && (hash || !racy)) nocc_hash_file(filepath, &input->hash);
+    return true;
+}
+
+/**
+ * @brief Takes the signatures of the inputs of a command before it starts, for nocc_db_record. Does nothing unless nocc_db_load was called.
+ * 
+ * @param {nocc_db_snapshot*} snapshot -- receives the signatures, free it with nocc_db_snapshot_free
+ * @param {const char**} inputfiles -- an array (or pointer to) a filename
+ * @param {size_t} input_files_size -- the length of the input files array (or 1) if it is a pointer.
+ * 
+ * @return {void}
+*/
+void nocc_db_snapshot_take(nocc_db_snapshot* snapshot, const char** inputfiles, size_t input_files_size) {
+    snapshot->taken = _nocc_file_time_now();
+    snapshot->inputs = NULL;
+    if(_nocc_db.path == NULL) return;
+
+    snapshot->inputs = nocc_da_reserve(nocc_db_input, input_files_size + 1);
+    for(size_t i = 0; i < input_files_size; i++) {
+        // The command has not read the file yet, so a hash taken now still describes what it builds from
+        nocc_db_input input;
+        if(_nocc_db_signature(inputfiles[i], snapshot->taken, true, &input)) nocc_da_push(snapshot->inputs, input);
+    }
+    qsort(snapshot->inputs, nocc_da_size(snapshot->inputs), sizeof(nocc_db_input), _nocc_db_compare_inputs);
+}
+
+void nocc_db_snapshot_free(nocc_db_snapshot* snapshot) {
+    if(snapshot->inputs) nocc_da_free(snapshot->inputs);
+    snapshot->inputs = NULL;
+}
+
+/**
+ * @brief Records what the output was just built from. Does nothing unless nocc_db_load was called.
+ * 
+ * @param {const char**} inputfiles -- an array (or pointer to) a filename, e.g. the sources plus the headers from the depfile
+ * @param {size_t} input_files_size -- the length of the input files array (or 1) if it is a pointer.
+ * @param {const char*} outputfile  -- the name of the target file that was built
+ * @param {nocc_darray(const char*)} cmd -- the command that built it
+ * @param {int64_t} duration -- how long it took in nanoseconds
+ * @param {const nocc_db_snapshot*} snapshot -- (optional) the signatures taken before the command started. Inputs missing
+ * from it (e.g. headers the command included for the first time) are trusted only if they did not change since then.
+ * Without it, files changed just now are recorded as changed.
+ * 
+ * @return {void}
+*/
+void nocc_db_record(const char** inputfiles, size_t input_files_size, const char* outputfile, nocc_darray(const char*) cmd, int64_t duration, const nocc_db_snapshot* snapshot) {
+    if(_nocc_db.path == NULL) return;
+
+    _nocc_db_entry* entry = _nocc_db_overlay(_nocc_db_key(outputfile));
+    nocc_da_clear(entry->inputs);
+    nocc_da_clear(entry->paths);
+    entry->cmd_hash = nocc_cmd_hash(cmd);
+    entry->duration = duration;
+
+    nocc_file_time since = snapshot ? snapshot->taken : _nocc_file_time_now();
+    size_t snapshot_size = snapshot && snapshot->inputs ? nocc_da_size(snapshot->inputs) : 0;
+    for(size_t i = 0; i < input_files_size; i++) {
+        nocc_db_input input;
+        const nocc_db_input* taken = snapshot_size ? _nocc_db_find_input(snapshot->inputs, snapshot_size, _nocc_db_key(inputfiles[i])) : NULL;
+        if(taken) input = *taken;
+        else if(!_nocc_db_signature(inputfiles[i], since, false, &input)) continue;
+        _nocc_db_entry_push(entry, input, inputfiles[i]);
+    }
+
+    size_t count = nocc_da_size(entry->inputs);
+    qsort(entry->inputs, count, sizeof(nocc_db_input), _nocc_db_compare_inputs);
+
+    // The same path can show up twice (e.g. as input and in the depfile)
+    size_t unique = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(unique > 0 && entry->inputs[unique - 1].key == entry->inputs[i].key) continue;
+        entry->inputs[unique++] = entry->inputs[i];
+    }
+    while(nocc_da_size(entry->inputs) > unique) nocc_da_remove(entry->inputs, nocc_da_size(entry->inputs) - 1, NULL);
+
+    _nocc_db.dirty = true;
+}
+
+/**
+ * @brief Whether the output has to be rebuilt according to the database: it does not know the output, the command
+ * changed, the output is missing, one of `inputfiles` is new, or one of the recorded inputs changed since it was built.
+ * Inputs are compared against their recorded signature rather than the output's mtime, so an edit saved while the output
+ * was being built is still seen. The headers come from the record, the depfile is not read.
+ * Always true when the database is not loaded.
+ * 
+ * @param {const char*} outputfile -- The output
+ * @param {nocc_darray(const char*)} cmd -- The command that builds it now
+ * @param {const char**} inputfiles -- the inputs it is built from now
+ * @param {size_t} input_files_size -- the length of the input files array
+ * 
+ * @return {bool}
+*/
+bool nocc_db_should_rebuild(const char* outputfile, nocc_darray(const char*) cmd, const char** inputfiles, size_t input_files_size) {
+    if(_nocc_db.path == NULL) return true;
+
+    uint64_t output_key = _nocc_db_key(outputfile);
+    _nocc_db_view view;
+    if(!_nocc_db_lookup(output_key, &view) || view.cmd_hash != nocc_cmd_hash(cmd)) return true;
+
+    nocc_file_time mtime;
+    uint64_t size;
+    if(!nocc_get_file_time(outputfile, &mtime, NULL)) return true;
+    for(size_t i = 0; i < input_files_size; i++) {
+        if(_nocc_db_find_input(view.inputs, view.input_count, _nocc_db_key(inputfiles[i])) == NULL) return true;
+    }
+
+    for(size_t i = 0; i < view.input_count; i++) {
+        const nocc_db_input* input = &view.inputs[i];
+        const char* inputfile = view.strings + input->path;
+        if(!nocc_get_file_time(inputfile, &mtime, &size) || size != input->size) return true;
+        if(input->mtime != 0 && input->mtime == mtime) continue;
+
+        uint64_t hash;
+        if(input->hash == 0 || !nocc_hash_file(inputfile, &hash) || hash != input->hash) return true;
+
+        // Only touched, remember the new time so it is not hashed again. Unless it is too fresh to be trusted yet.
+        if(mtime > _nocc_file_time_now() - _NOCC_DB_RACY_NS) continue;
+        _nocc_db_entry* entry = _nocc_db_overlay(output_key);
+        ((nocc_db_input*)_nocc_db_find_input(entry->inputs, nocc_da_size(entry->inputs), input->key))->mtime = mtime;
+        _nocc_db.dirty = true;
+        // The overlay may have moved the record
+        _nocc_db_lookup(output_key, &view);
+    }
+    return false;
+}
+
+// Build Database End =====================================================
+
+// Command Begin
+#define nocc_cmd_add(cmd, ...)          nocc_da_pushn(cmd, sizeof((const char*[]){__VA_ARGS__}) / sizeof(const char*), ((const char*[]){__VA_ARGS__}))
+#define nocc_cmd_addn(cmd, n, a)        nocc_da_pushn(cmd, n, a)
+
+// The index of the argument, or the size of the command if it is not there
+size_t _nocc_cmd_find_arg(nocc_darray(const char*) cmd, const char* arg) {
+    size_t i = 0;
+    for(; i < nocc_da_size(cmd); i++) {
+        if(strcmp(cmd[i], arg) == 0) break;
+    }
+    return i;
+}
+
+// The value following a flag, e.g. "-o" -> "main.o"
+const char* _nocc_cmd_arg_value(nocc_darray(const char*) cmd, const char* flag) {
+    size_t i = _nocc_cmd_find_arg(cmd, flag);
+    return i + 1 < nocc_da_size(cmd) ? cmd[i + 1] : NULL;
+}
+
+// The compiler writes -o and -MF, whatever the cache knew about them is wrong afterwards
+void _nocc_cmd_invalidate_outputs(nocc_darray(const char*) cmd) {
+    const char* output = _nocc_cmd_arg_value(cmd, "-o");
+    const char* depfile = _nocc_cmd_arg_value(cmd, "-MF");
+    if(output) nocc_stat_cache_invalidate(output);
+    if(depfile) nocc_stat_cache_invalidate(depfile);
+}
+
+#ifdef _WIN32
+    typedef HANDLE pid;
+    #define NOCC_INVALID_PID NULL
+#else // _WIN32
+    typedef pid_t pid;
+    #define NOCC_INVALID_PID -1
+#endif // _WIN32
+
+#ifndef _WIN32
+int _nocc_cmd_exit_code(int wstatus) {
+    // A failing command is not an error of nocc, the callers report it
+    if(WIFEXITED(wstatus)) return WEXITSTATUS(wstatus);
+    // The same code a shell reports
+    if(WIFSIGNALED(wstatus)) return 128 + WTERMSIG(wstatus);
+
+    return -1;
+}
+#endif // _WIN32
+
+int _nocc_cmd_pid_wait(pid pid) {
+#ifdef _WIN32
+    DWORD result = WaitForSingleObject(pid, INFINITE);
+
+    if(result == WAIT_FAILED) {
+        nocc_assert(false, "Could not wait for child process %s", GetLastError());
+        return -1;
+    }
+
+    DWORD exit_code;
+    if(GetExitCodeProcess(pid, &exit_code) == 0) {
+        nocc_assert(false, "Could not get the exit code %lu", GetLastError());
+        return -1;
+    }
+
+    CloseHandle(pid);
+    return (int)exit_code;
+#else
+    for(;;) {
+        int wstatus = 0;
+        if(waitpid(pid, &wstatus, 0) < 0) {
+            if(errno == EINTR) continue;
+            nocc_error("Could not wait for child process %d: %s", (int)pid, strerror(errno));
+            return -1;
+        }
+
+        if(WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+            return _nocc_cmd_exit_code(wstatus);
+        }
+    }
+#endif // _WIN32
+}
+
+/**
+ * @brief Where the standard handles of a command go. NULL keeps the handle nocc inherited.
+ * stdout and stderr may name the same file, they then share it.
+*/
+typedef struct {
+    const char* stdin_path;
+    const char* stdout_path;
+    const char* stderr_path;
+} nocc_cmd_redirect;
+
+#ifdef _WIN32
+HANDLE _nocc_cmd_open_handle(const char* path, bool write, HANDLE fallback) {
+    if(path == NULL) return fallback;
+
+    SECURITY_ATTRIBUTES attributes = { .nLength = sizeof(SECURITY_ATTRIBUTES), .lpSecurityDescriptor = NULL, .bInheritHandle = TRUE };
+    return CreateFileA(path, write ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &attributes,
+                       write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+#else
+extern char** environ;
+#endif // _WIN32
+
+// Commands longer than this (in bytes, counting the separators) pass their arguments through a response file.
+// CreateProcess takes at most 32767 characters, so Windows switches a little before that.
+#ifndef NOCC_RSP_THRESHOLD
+    #ifdef _WIN32
+        #define NOCC_RSP_THRESHOLD (30 * 1024)
+    #else
+        #define NOCC_RSP_THRESHOLD (32 * 1024)
+    #endif // _WIN32
+#endif // NOCC_RSP_THRESHOLD
+
+// The file name of the program, without its directory
+const char* _nocc_cmd_program_name(const char* program) {
+    const char* name = program;
+    for(const char* it = program; *it; it++) {
+        if(*it == '/' || *it == '\\') name = it + 1;
+    }
+    return name;
+}
+
+// The program is `tool` or ends in -`tool`, with or without an extension, e.g. "link", "lld-link.exe" for "link"
+bool _nocc_cmd_program_is(const char* name, const char* tool) {
+    size_t length = strcspn(name, ".");
+    size_t size = strlen(tool);
+    return length >= size && strncmp(name + length - size, tool, size) == 0 && (length == size || name[length - size - 1] == '-');
+}
+
+// Compilers, linkers and archivers read @file, e.g. "clang", "x86_64-linux-gnu-gcc", "/usr/bin/ld.lld", "llvm-ar.exe"
+bool _nocc_cmd_accepts_rsp(const char* program) {
+    const char* name = _nocc_cmd_program_name(program);
+    if(strstr(name, "clang") || strstr(name, "gcc") || strstr(name, "g++") || strstr(name, "lld")) return true;
+
+    static const char* tools[] = { "cc", "c++", "ld", "ar", "cl", "link", "lib" };
+    for(size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++) {
+        // The last part of the name, so cross toolchains (<triple>-ld) count too
+        if(_nocc_cmd_program_is(name, tools[i])) return true;
+    }
+    return false;
+}
+
+// MSVC tools (and clang-cl, lld-link, llvm-lib) split response files like a Windows command line, not like GCC
+bool _nocc_cmd_msvc_rsp(const char* program) {
+    const char* name = _nocc_cmd_program_name(program);
+    return _nocc_cmd_program_is(name, "cl") || _nocc_cmd_program_is(name, "link") || _nocc_cmd_program_is(name, "lib");
+}
+
+// Quoted the way MSVC reads response files: backslashes are literal unless they come before a quote,
+// so C:\dir\a.obj stays as it is and only the backslashes in front of a '"' are doubled
+void _nocc_cmd_rsp_push_arg_msvc(nocc_string* content, const char* arg) {
+    bool quote = arg[0] == '\0' || strpbrk(arg, " \t\n\r\"") != NULL;
+    if(quote) nocc_str_push_char(*content, '"');
+    size_t backslashes = 0;
+    for(const char* it = arg; *it; it++) {
+        if(*it == '\\') {
+            backslashes++;
+        } else {
+            if(*it == '"') {
+                for(size_t i = 0; i <= backslashes; i++) nocc_str_push_char(*content, '\\');
+            }
+            backslashes = 0;
+        }
+        nocc_str_push_char(*content, *it);
+    }
+    // The closing quote must not be escaped by a trailing backslash
+    if(quote) {
+        for(size_t i = 0; i < backslashes; i++) nocc_str_push_char(*content, '\\');
+        nocc_str_push_char(*content, '"');
+    }
+    nocc_str_push_char(*content, '\n');
+}
+
+// Quoted the way GCC and Clang read response files
+void _nocc_cmd_rsp_push_arg(nocc_string* content, const char* arg) {
+    bool quote = arg[0] == '\0' || strpbrk(arg, " \t\n\r\"'\\") != NULL;
+    if(quote) nocc_str_push_char(*content, '"');
+    for(const char* it = arg; *it; it++) {
+        if(*it == '"' || *it == '\\') nocc_str_push_char(*content, '\\');
+        nocc_str_push_char(*content, *it);
+    }
+    if(quote) nocc_str_push_char(*content, '"');
+    nocc_str_push_char(*content, '\n');
+}
+
+// For commands over NOCC_RSP_THRESHOLD: writes the arguments to <output>.rsp (or nocc_<hash>.rsp) and returns { program, "@file" },
+// the second string is owned by the caller. The file is left alone if it already holds the same arguments.
+nocc_darray(const char*) _nocc_cmd_response_file(nocc_darray(const char*) cmd) {
+    size_t size = 0;
+    for(size_t i = 0; i < nocc_da_size(cmd); i++) size += strlen(cmd[i]) + 1;
+    if(size <= NOCC_RSP_THRESHOLD || !_nocc_cmd_accepts_rsp(cmd[0])) return NULL;
+
+    bool msvc = _nocc_cmd_msvc_rsp(cmd[0]);
+    nocc_string content = nocc_str_reserve(size + size / 8);
+    for(size_t i = 1; i < nocc_da_size(cmd); i++) {
+        if(msvc) _nocc_cmd_rsp_push_arg_msvc(&content, cmd[i]);
+        else     _nocc_cmd_rsp_push_arg(&content, cmd[i]);
+    }
+
+    nocc_string path = nocc_str_create();
+    nocc_str_push_char(path, '@');
+    const char* output = _nocc_cmd_arg_value(cmd, "-o");
+    if(output) {
+        nocc_str_push_cstr(path, output);
+    } else {
+        char name[32];
+        snprintf(name, sizeof(name), "nocc_%016llx", (unsigned long long)nocc_cmd_hash(cmd));
+        nocc_str_push_cstr(path, name);
+    }
+    nocc_str_push_cstr(path, ".rsp");
+    nocc_str_push_null(path);
+
+    size_t existing_size = 0;
+    char* existing = nocc_read_entire_file(path + 1, &existing_size);
+    bool same = existing && existing_size == nocc_da_size(content) && memcmp(existing, content, existing_size) == 0;
+    free(existing);
+
+    bool status = true;
+    if(!same) {
+        FILE* file = fopen(path + 1, "wb");
+        status = file != NULL && fwrite(content, 1, nocc_da_size(content), file) == nocc_da_size(content);
+        if(file && fclose(file) != 0) status = false;
+        nocc_stat_cache_invalidate(path + 1);
+    }
+    nocc_str_free(content);
+
+    if(!status) {
+        nocc_warn("Could not write the response file %s, passing the arguments directly", path + 1);
+        nocc_str_free(path);
+        return NULL;
+    }
+
+    nocc_darray(const char*) rsp_cmd = nocc_da_reserve(const char*, 2);
+    nocc_cmd_add(rsp_cmd, cmd[0], (const char*)strdup(path));
+    nocc_str_free(path);
+    return rsp_cmd;
+}
+
+// Starts the command. Valid `output_fd` and `error_fd` receive stdout and stderr and win over `redirect` (POSIX only).
+// With `own_group` the process leads a new process group, so it can be killed along with its children (POSIX only).
+pid _nocc_cmd_spawn(nocc_darray(const char*) cmd, const nocc_cmd_redirect* redirect, int output_fd, int error_fd, bool own_group) {
+    nocc_darray(const char*) rsp_cmd = _nocc_cmd_response_file(cmd);
+    if(rsp_cmd) {
+        pid cpid = _nocc_cmd_spawn(rsp_cmd, redirect, output_fd, error_fd, own_group);
+        free((char*)rsp_cmd[1]);
+        nocc_da_free(rsp_cmd);
+        return cpid;
+    }
+
+    nocc_cmd_redirect none = { NULL, NULL, NULL };
+    if(redirect == NULL) redirect = &none;
+#ifdef _WIN32
+    nocc_string built_command = nocc_str_create();
+    for(size_t i = 0; i < nocc_da_size(cmd); i++) {
+        nocc_str_push_cstr(built_command, cmd[i]);
+        nocc_str_push_char(built_command, ' ');
+    }
+    nocc_str_push_null(built_command);
+
+    STARTUPINFO siStartInfo;
+    ZeroMemory(&siStartInfo, sizeof(siStartInfo));
+    siStartInfo.cb = sizeof(STARTUPINFO);
+    // NOTE: theoretically setting NULL to std handles should not be a problem
+    // https://docs.microsoft.com/en-us/windows/console/getstdhandle?redirectedfrom=MSDN#attachdetach-behavior
+    // TODO: check for errors in GetStdHandle
+    siStartInfo.hStdInput = _nocc_cmd_open_handle(redirect->stdin_path, false, GetStdHandle(STD_INPUT_HANDLE));
+    siStartInfo.hStdOutput = _nocc_cmd_open_handle(redirect->stdout_path, true, GetStdHandle(STD_OUTPUT_HANDLE));
+    if(redirect->stderr_path && redirect->stdout_path && strcmp(redirect->stderr_path, redirect->stdout_path) == 0) {
+        siStartInfo.hStdError = siStartInfo.hStdOutput;
+    } else {
+        siStartInfo.hStdError = _nocc_cmd_open_handle(redirect->stderr_path, true, GetStdHandle(STD_ERROR_HANDLE));
+    }
+    siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
+
+    PROCESS_INFORMATION piProcInfo;
+    ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
+
+    BOOL bSuccess =
+        CreateProcess(
+            NULL,
+            built_command,
+            NULL,
+            NULL,
+            TRUE,
+            0,
+            NULL,
+            NULL,
+            &siStartInfo,
+            &piProcInfo
+        );
+
+    nocc_str_free(built_command);
+    if(redirect->stdin_path) CloseHandle(siStartInfo.hStdInput);
+    if(redirect->stdout_path) CloseHandle(siStartInfo.hStdOutput);
+    if(redirect->stderr_path && siStartInfo.hStdError != siStartInfo.hStdOutput) CloseHandle(siStartInfo.hStdError);
+
+    if (!bSuccess) {
+        // TODO: Improve error handling
+        nocc_assert(false, "Failed to fork child process");
+        return NOCC_INVALID_PID;
+    }
+
+    CloseHandle(piProcInfo.hThread);
+
+    return piProcInfo.hProcess;
+#else // ifndef _WIN32
+    // posix_spawnp wants a NULL terminated argv, the darray is not.
+    size_t argc = nocc_da_size(cmd);
+    char** argv = calloc(argc + 1, sizeof(char*));
+    memcpy(argv, cmd, argc * sizeof(char*));
+
+    // posix_spawn does not duplicate the address space like fork does (glibc uses CLONE_VM | CLONE_VFORK),
+    // so starting a process costs the same no matter how much memory the build holds.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if(redirect->stdin_path) posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, redirect->stdin_path, O_RDONLY, 0);
+    if(redirect->stdout_path && output_fd < 0) posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, redirect->stdout_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(output_fd >= 0) posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    if(error_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, error_fd, STDERR_FILENO);
+    } else if(redirect->stderr_path && redirect->stdout_path && strcmp(redirect->stderr_path, redirect->stdout_path) == 0) {
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    } else if(redirect->stderr_path) {
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, redirect->stderr_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    // Anything still buffered would otherwise show up after the output of the child
+    nocc_log_flush();
+    pid_t cpid;
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    // The server ignores SIGPIPE, which children would inherit otherwise
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if(own_group) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attributes, 0);
+    }
+    posix_spawnattr_setflags(&attributes, flags);
+    int error = posix_spawnp(&cpid, argv[0], &actions, &attributes, argv, environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    free(argv);
+
+    if(error != 0) {
+        nocc_error("Failed to execute cmd %s: %s", cmd[0], strerror(error));
+        return NOCC_INVALID_PID;
+    }
+
+    return cpid;
+#endif // _WIN32
+}
+
+pid _nocc_cmd_run_command_async(nocc_darray(const char*) cmd) {
+    return _nocc_cmd_spawn(cmd, NULL, -1, -1, false);
+}
+
+bool _nocc_cache_applies(nocc_darray(const char*) cmd);
+bool _nocc_cache_execute(nocc_darray(const char*) cmd);
+void _nocc_compdb_record(nocc_darray(const char*) cmd);
+nocc_darray(const char*) _nocc_pch_apply(nocc_darray(const char*) cmd);
+
+/**
+ * @brief Runs the command and waits for it to finish.
+ * 
+ * @param {nocc_darray(const char*)} cmd -- the command and its arguments
+ * 
+ * @return {bool} true if the command exited with 0.
+*/
+bool nocc_cmd_execute(nocc_darray(const char*) cmd) {
+    _nocc_compdb_record(cmd);
+    if(_nocc_cache_applies(cmd)) return _nocc_cache_execute(cmd);
+
+    nocc_darray(const char*) pch_cmd = _nocc_pch_apply(cmd);
+    pid pid = _nocc_cmd_run_command_async(pch_cmd ? pch_cmd : cmd);
+    if(pch_cmd) nocc_da_free(pch_cmd);
+    if(pid == NOCC_INVALID_PID) return false;
+    int exit_code = _nocc_cmd_pid_wait(pid);
+    _nocc_cmd_invalidate_outputs(cmd);
+    return exit_code == 0;
+}
+
+/**
+ * @brief Runs the command with its standard handles redirected to files and waits for it to finish.
+ * 
+ * @param {nocc_darray(const char*)} cmd -- the command and its arguments
+ * @param {const nocc_cmd_redirect*} redirect -- where stdin, stdout and stderr go
+ * 
+ * @return {bool} true if the command exited with 0.
+*/
+bool nocc_cmd_execute_redirect(nocc_darray(const char*) cmd, const nocc_cmd_redirect* redirect) {
+    pid pid = _nocc_cmd_spawn(cmd, redirect, -1, -1, false);
+    if(pid == NOCC_INVALID_PID) return false;
+    int exit_code = _nocc_cmd_pid_wait(pid);
+    _nocc_cmd_invalidate_outputs(cmd);
+    if(redirect && redirect->stdout_path) nocc_stat_cache_invalidate(redirect->stdout_path);
+    if(redirect && redirect->stderr_path) nocc_stat_cache_invalidate(redirect->stderr_path);
+    return exit_code == 0;
+}
+
+// true if the input is the same as when the output was last built
+bool _nocc_input_unchanged(const char* inputfile, const char* outputfile, nocc_file_time mtime, uint64_t size) {
+    if(_nocc_db.path == NULL) return false;
+
+    uint64_t output_key = _nocc_db_key(outputfile);
+    _nocc_db_view view;
+    if(!_nocc_db_lookup(output_key, &view)) return false;
+
+    uint64_t input_key = _nocc_db_key(inputfile);
+    const nocc_db_input* input = _nocc_db_find_input(view.inputs, view.input_count, input_key);
+    if(input == NULL || input->size != size) return false;
+    if(input->mtime != 0 && input->mtime == mtime) return true;
+    if(!_nocc_db.hash_contents || input->hash == 0) return false;
+
+    uint64_t hash;
+    if(!nocc_hash_file(inputfile, &hash) || hash != input->hash) return false;
+
+    // Only touched, remember the new time so it is not hashed again
+    _nocc_db_entry* entry = _nocc_db_overlay(output_key);
+    nocc_db_input* recorded = (nocc_db_input*)_nocc_db_find_input(entry->inputs, nocc_da_size(entry->inputs), input_key);
+    recorded->mtime = mtime;
+    _nocc_db.dirty = true;
+    return true;
+}
+
+/**
+ * @brief determines whether the file should be recompiled or not.
+ * 
+ * @param {const char**} inputfiles -- an array (or pointer to) a filename
+ * @param {size_t} input_files_size -- the length of the input files array (or 1) if it is a pointer.
+ * @param {const char*} outputfile  -- the name of the target file 
+ * 
+ * @return {bool} return's true, if needs to rebuild 
+*/
+bool nocc_should_recompile(const char** inputfiles, size_t input_files_size, const char* outputfile) {
+    nocc_file_time output_file_time;
+    if(!nocc_get_file_time(outputfile, &output_file_time, NULL)) {
+        // NOTE: if output does not exist it 100% must be rebuilt
+        if(errno == ENOENT) return true;
+        nocc_error("could not stat %s: %s", outputfile, strerror(errno));
+        return true;
+    }
+
+    for(size_t i = 0; i < input_files_size; ++i) {
+        const char* inputfile = inputfiles[i];
+        nocc_file_time input_file_time;
+        uint64_t input_file_size;
+        if(!nocc_get_file_time(inputfile, &input_file_time, &input_file_size)) {
+            // NOTE: non-existing input is an error cause it is needed for building in the first place
+            nocc_error("could not stat %s: %s", inputfile, strerror(errno));
+            return true;
+        }
+
+        // NOTE: if even a single inputfile is fresher (and actually changed) that's 100% rebuild
+        if(input_file_time > output_file_time && !_nocc_input_unchanged(inputfile, outputfile, input_file_time, input_file_size)) return true;
+    }
+
+    return false;
+}
+
+bool nocc_should_recompile1(const char* inputfile, const char* outputfile) {
+    return nocc_should_recompile(&inputfile, 1, outputfile);
+}
+
+/**
+ * @brief Makes the compiler write the headers the file includes to `depfile` (gcc/clang -MMD -MF).
+ * 
+ * @param {nocc_darray(const char*)} cmd -- the compile command
+ * @param {const char*} depfile -- where the compiler writes the dependencies, usually next to the object file.
+ * 
+ * @return {void}
+*/
+#define nocc_cmd_add_depfile(cmd, depfile)  nocc_cmd_add(cmd, "-MMD", "-MF", depfile)
+
+/**
+ * @brief Parses a Makefile style depfile (`out.o: in.c a.h \`) in place. The targets of the rules are skipped,
+ * every prerequisite is pushed as a pointer into `data`, so nothing is allocated per entry. A prerequisite already in `prereqs`
+ * (also as "./path") is not pushed again.
+ * Escaped spaces (`\ `), `\#` and `$$` are unescaped, line continuations are treated as whitespace.
+ * 
+ * @param {char*} data -- the NULL terminated contents of the depfile, it is modified.
+ * @param {size_t} size -- the size of data without the terminator.
+ * @param {nocc_darray(const char*)*} prereqs -- receives the prerequisites.
+ * 
+ * @return {void}
+*/
+void nocc_depfile_parse(char* data, size_t size, nocc_darray(const char*)* prereqs) {
+    size_t first = nocc_da_size(*prereqs);
+    char* read = data;
+    char* end = data + size;
+
+    while(read < end) {
+        char c = *read;
+        if(c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0') { read++; continue; }
+        if(c == '\\' && read + 1 < end && (read[1] == '\n' || read[1] == '\r')) { read += 2; continue; }
+
+        char* token = read;
+        char* write = read;
+        bool is_target = false;
+        while(read < end) {
+            c = *read;
+            if(c == ' ' || c == '\t' || c == '\r' || c == '\n') break;
+            if(c == '\\' && read + 1 < end) {
+                char next = read[1];
+                if(next == ' ' || next == '#') { *write++ = next; read += 2; continue; }
+                if(next == '\n' || next == '\r') break;
+            }
+            if(c == '$' && read + 1 < end && read[1] == '$') { *write++ = '$'; read += 2; continue; }
+            // NOTE: a colon only ends a target when it is followed by whitespace, so C:\path stays intact.
+            if(c == ':' && (read + 1 == end || read[1] == ' ' || read[1] == '\t' || read[1] == '\r' || read[1] == '\n')) {
+                is_target = true;
+                read++;
+                break;
+            }
+            *write++ = c;
+            read++;
+        }
+
+        // write never passes read, so terminating the token cannot clobber unread input
+        if(read == write && read < end) read++;
+        *write = '\0';
+        if(!is_target && write != token) nocc_da_push(*prereqs, (const char*)token);
+    }
+    // The source is listed again (often without the "./" it was given with), and so can be a header
+    _nocc_paths_unique(*prereqs, first);
+}
+
+/**
+ * @brief Same as nocc_should_recompile, but also checks the headers listed in the depfile the compiler wrote
+ * for the output. A missing depfile means the output was never built with it, so it is rebuilt.
+ * 
+ * @param {const char**} inputfiles -- an array (or pointer to) a filename
+ * @param {size_t} input_files_size -- the length of the input files array (or 1) if it is a pointer.
+ * @param {const char*} outputfile  -- the name of the target file
+ * @param {const char*} depfile -- the depfile written by nocc_cmd_add_depfile
+ * 
+ * @return {bool} return's true, if needs to rebuild
+*/
+bool nocc_should_recompile_depfile(const char** inputfiles, size_t input_files_size, const char* outputfile, const char* depfile) {
+    if(nocc_should_recompile(inputfiles, input_files_size, outputfile)) return true;
+
+    size_t size = 0;
+    char* data = nocc_read_entire_file(depfile, &size);
+    if(data == NULL) return true;
+
+    nocc_darray(const char*) prereqs = nocc_da_create(const char*);
+    nocc_depfile_parse(data, size, &prereqs);
+    bool stale = nocc_should_recompile(prereqs, nocc_da_size(prereqs), outputfile);
+
+    nocc_da_free(prereqs);
+    free(data);
+    return stale;
+}
+
+// Command Ends
+
+// Cache Begin ============================================================
+
+typedef struct {
+    char* dir;
+    bool hardlink;
+    uint64_t counter;
+    size_t hits, misses;
+} _nocc_cache_t;
+
+static _nocc_cache_t _nocc_cache = {0};
+
+typedef enum {
+    _NOCC_CACHE_PREPROCESS,
+    _NOCC_CACHE_COMPILE
+} _nocc_cache_phase;
+
+// A compile command going through the cache. It owns a copy of the command, the caller may free it after submitting.
+typedef struct {
+    _nocc_cache_phase phase;
+    nocc_darray(const char*) cmd;
+    nocc_darray(char*) strings;
+    const char* output;
+    const char* depfile;
+    nocc_string preprocessed;
+    uint64_t key;               // 0 until the preprocessed source was hashed
+} _nocc_cache_job;
+
+/**
+ * @brief Enables the object cache. Compile commands (`-c ... -o out`) that go through nocc_cmd_execute or a job pool
+ * are first preprocessed, the object is then looked up by the hash of the preprocessed source, the compiler and
+ * the command line. A hit copies the cached object (and depfile) instead of running the compiler.
+ * Only gcc/clang style command lines are understood.
+ * 
+ * @param {const char*} dir -- where the cache lives, e.g. "./.nocc_cache"
+ * @param {bool} hardlink -- restore objects by hardlinking them. Outputs are then deleted before they are compiled,
+ * so the compiler never writes into the cache through the link. Do not compile into them outside of nocc.
+ * Depfiles are small and rewritten in place by the compiler, so they are always copied.
+ * 
+ * @return {bool} false if the cache directory could not be created.
+*/
+bool nocc_cache_enable(const char* dir, bool hardlink) {
+    nocc_string tmp = nocc_str_create();
+    nocc_str_push_cstr(tmp, dir);
+    nocc_str_push_cstr(tmp, "/tmp");
+    nocc_str_push_null(tmp);
+
+    bool status = nocc_mkdir_if_not_exists(dir) && nocc_mkdir_if_not_exists(tmp);
+    nocc_str_free(tmp);
+    if(!status) return false;
+
+    free(_nocc_cache.dir);
+    _nocc_cache.dir = strdup(dir);
+    _nocc_cache.hardlink = hardlink;
+    return true;
+}
+
+bool _nocc_cache_applies(nocc_darray(const char*) cmd) {
+    if(_nocc_cache.dir == NULL || nocc_da_size(cmd) == 0) return false;
+    return _nocc_cmd_find_arg(cmd, "-c") < nocc_da_size(cmd) && _nocc_cmd_arg_value(cmd, "-o") != NULL;
+}
+
+bool _nocc_copy_file(const char* src, const char* dst) {
+#ifdef _WIN32
+    return CopyFileA(src, dst, FALSE);
+#else
+    size_t size = 0;
+    char* data = nocc_read_entire_file(src, &size);
+    if(data == NULL) return false;
+
+    FILE* file = fopen(dst, "wb");
+    bool status = file != NULL && fwrite(data, 1, size, file) == size;
+    if(file && fclose(file) != 0) status = false;
+
+    free(data);
+    return status;
+#endif // _WIN32
+}
+
+bool _nocc_rename_file(const char* src, const char* dst) {
+#ifdef _WIN32
+    return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING);
+#else
+    return rename(src, dst) == 0;
+#endif // _WIN32
+}
+
+// <dir>/<first two hex digits>/<rest of the key>.<ext>
+nocc_string _nocc_cache_path(uint64_t key, const char* ext, bool shard_only) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+
+    nocc_string path = nocc_str_create();
+    nocc_str_push_cstr(path, _nocc_cache.dir);
+    nocc_str_push_char(path, '/');
+    nocc_da_pushn(path, 2, hex);
+    if(!shard_only) {
+        nocc_str_push_char(path, '/');
+        nocc_str_push_cstr(path, hex + 2);
+        nocc_str_push_cstr(path, ext);
+    }
+    nocc_str_push_null(path);
+    return path;
+}
+
+nocc_string _nocc_cache_tmp_path(const char* ext) {
+    char name[64];
+#ifdef _WIN32
+    unsigned long process = GetCurrentProcessId();
+#else
+    unsigned long process = (unsigned long)getpid();
+#endif // _WIN32
+    snprintf(name, sizeof(name), "/tmp/%lu-%llu%s", process, (unsigned long long)_nocc_cache.counter++, ext);
+
+    nocc_string path = nocc_str_create();
+    nocc_str_push_cstr(path, _nocc_cache.dir);
+    nocc_str_push_cstr(path, name);
+    nocc_str_push_null(path);
+    return path;
+}
+
+// Identifies the compiler by its resolved path, modification time and size, so an upgraded compiler misses the cache.
+uint64_t _nocc_cache_compiler_identity(const char* compiler) {
+    static nocc_darray(uint64_t) known = NULL;   // pairs of (hash of the name, identity)
+    if(known == NULL) known = nocc_da_create(uint64_t);
+
+    uint64_t name = nocc_hash_cstr(compiler, 0);
+    for(size_t i = 0; i < nocc_da_size(known); i += 2) {
+        if(known[i] == name) return known[i + 1];
+    }
+
+    uint64_t identity = name;
+    nocc_file_time mtime;
+    uint64_t size;
+    if(strchr(compiler, '/') || strchr(compiler, '\\')) {
+        if(nocc_get_file_time(compiler, &mtime, &size)) {
+            identity = nocc_hash(&mtime, sizeof(mtime), nocc_hash(&size, sizeof(size), identity));
+        }
+    } else {
+        const char* path = getenv("PATH");
+#ifdef _WIN32
+        const char separator = ';';
+#else
+        const char separator = ':';
+#endif // _WIN32
+        while(path && *path) {
+            const char* end = strchr(path, separator);
+            size_t length = end ? (size_t)(end - path) : strlen(path);
+
+            nocc_string candidate = nocc_str_create();
+            if(length > 0) nocc_da_pushn(candidate, length, (void*)path);
+            nocc_str_push_char(candidate, '/');
+            nocc_str_push_cstr(candidate, compiler);
+            nocc_str_push_null(candidate);
+
+            bool found = nocc_get_file_time(candidate, &mtime, &size);
+            if(found) {
+                identity = nocc_hash_cstr(candidate, identity);
+                identity = nocc_hash(&mtime, sizeof(mtime), nocc_hash(&size, sizeof(size), identity));
+            }
+            nocc_str_free(candidate);
+            if(found || end == NULL) break;
+            path = end + 1;
+        }
+    }
+
+    nocc_da_push(known, name);
+    nocc_da_push(known, identity);
+    return identity;
+}
+
+_nocc_cache_job* _nocc_cache_job_create(nocc_darray(const char*) cmd) {
+    _nocc_cache_job* job = calloc(1, sizeof(_nocc_cache_job));
+    job->phase = _NOCC_CACHE_PREPROCESS;
+    job->cmd = nocc_da_reserve(const char*, nocc_da_size(cmd) + 1);
+    job->strings = nocc_da_reserve(char*, nocc_da_size(cmd) + 1);
+    for(size_t i = 0; i < nocc_da_size(cmd); i++) {
+        char* copy = strdup(cmd[i]);
+        nocc_da_push(job->strings, copy);
+        nocc_da_push(job->cmd, (const char*)copy);
+    }
+    job->output = _nocc_cmd_arg_value(job->cmd, "-o");
+    job->depfile = _nocc_cmd_arg_value(job->cmd, "-MF");
+    job->preprocessed = _nocc_cache_tmp_path(".i");
+    return job;
+}
+
+void _nocc_cache_job_free(_nocc_cache_job* job) {
+    remove(job->preprocessed);
+    for(size_t i = 0; i < nocc_da_size(job->strings); i++) free(job->strings[i]);
+    nocc_da_free(job->strings);
+    nocc_da_free(job->cmd);
+    nocc_str_free(job->preprocessed);
+    free(job);
+}
+
+const char* _nocc_pch_header(void);
+
+// The command with -c swapped for -E, writing into a temporary file, without the depfile flags.
+// A precompiled header is included as text, so its contents end up in the key.
+nocc_darray(const char*) _nocc_cache_preprocess_cmd(_nocc_cache_job* job) {
+    nocc_darray(const char*) cmd = nocc_da_reserve(const char*, nocc_da_size(job->cmd) + 1);
+    for(size_t i = 0; i < nocc_da_size(job->cmd); i++) {
+        const char* arg = job->cmd[i];
+        if(strcmp(arg, "-MMD") == 0 || strcmp(arg, "-MD") == 0 || strcmp(arg, "-MP") == 0) continue;
+        if(strcmp(arg, "-MF") == 0 || strcmp(arg, "-MT") == 0 || strcmp(arg, "-MQ") == 0) { i++; continue; }
+        if(strcmp(arg, "-c") == 0) arg = "-E";
+        if(strcmp(arg, "-include-pch") == 0 && _nocc_pch_header()) {
+            nocc_cmd_add(cmd, "-include", _nocc_pch_header());
+            i++;
+            continue;
+        }
+        if(strcmp(arg, "-o") == 0) {
+            nocc_cmd_add(cmd, "-o", job->preprocessed);
+            i++;
+            continue;
+        }
+        nocc_da_push(cmd, arg);
+    }
+    return cmd;
+}
+
+// Computes the key from the preprocessed source. The paths of the outputs do not change the object and are left out.
+bool _nocc_cache_compute_key(_nocc_cache_job* job) {
+    uint64_t key;
+    if(!nocc_hash_file(job->preprocessed, &key)) return false;
+    remove(job->preprocessed);
+
+    key = nocc_hash(&(uint64_t){ _nocc_cache_compiler_identity(job->cmd[0]) }, sizeof(uint64_t), key);
+    for(size_t i = 1; i < nocc_da_size(job->cmd); i++) {
+        const char* arg = job->cmd[i];
+        if(strcmp(arg, "-o") == 0 || strcmp(arg, "-MF") == 0) { i++; continue; }
+        key = nocc_hash(arg, strlen(arg) + 1, key);
+    }
+
+    // Debug info embeds the working directory
+    if(_nocc_cmd_find_arg(job->cmd, "-g") < nocc_da_size(job->cmd)) {
+        char cwd[4096] = "";
+#ifdef _WIN32
+        _getcwd(cwd, sizeof(cwd));
+#else
+        if(getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+#endif // _WIN32
+        key = nocc_hash_cstr(cwd, key);
+    }
+
+    job->key = key == 0 ? 1 : key;
+    return true;
+}
+
+// Sets the modification time of the file to now
+bool _nocc_touch_file(const char* filepath) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return false;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    bool status = SetFileTime(file, NULL, NULL, &now);
+    CloseHandle(file);
+    return status;
+#else
+    return utimensat(AT_FDCWD, filepath, NULL, 0) == 0;
+#endif // _WIN32
+}
+
+// A link (or on Windows, a copy) keeps the time the entry was cached, the output is touched so it is newer than its inputs
+bool _nocc_cache_restore_file(const char* cached, const char* output, bool link_it) {
+    remove(output);
+    bool status = false;
+#ifndef _WIN32
+    if(link_it) status = link(cached, output) == 0;
+#else
+    if(link_it) status = CreateHardLinkA(output, cached, NULL);
+#endif // _WIN32
+    if(!status) status = _nocc_copy_file(cached, output);
+    return status && _nocc_touch_file(output);
+}
+
+// true on a hit, the outputs are then in place
+bool _nocc_cache_lookup(_nocc_cache_job* job) {
+    nocc_string object = _nocc_cache_path(job->key, ".o", false);
+    nocc_string depfile = _nocc_cache_path(job->key, ".d", false);
+
+    nocc_file_time mtime;
+    bool hit = nocc_get_file_time(object, &mtime, NULL);
+    if(hit && job->depfile) hit = _nocc_cache_restore_file(depfile, job->depfile, false);
+    if(hit) hit = _nocc_cache_restore_file(object, job->output, _nocc_cache.hardlink);
+
+    if(hit) {
+        _nocc_cache.hits++;
+        nocc_debug("Cache hit %s", job->output);
+    } else {
+        _nocc_cache.misses++;
+    }
+
+    nocc_str_free(object);
+    nocc_str_free(depfile);
+    return hit;
+}
+
+// Copies a file into the cache through a temporary file, so readers never see a partial entry
+bool _nocc_cache_store_file(const char* src, uint64_t key, const char* ext) {
+    nocc_string tmp = _nocc_cache_tmp_path(ext);
+    nocc_string dst = _nocc_cache_path(key, ext, false);
+
+    bool status = _nocc_copy_file(src, tmp);
+    if(status && !_nocc_rename_file(tmp, dst)) {
+        nocc_string shard = _nocc_cache_path(key, ext, true);
+        nocc_mkdir_if_not_exists(shard);
+        nocc_str_free(shard);
+        status = _nocc_rename_file(tmp, dst);
+    }
+    if(!status) remove(tmp);
+    nocc_stat_cache_invalidate(dst);
+
+    nocc_str_free(tmp);
+    nocc_str_free(dst);
+    return status;
+}
+
+void _nocc_cache_store(_nocc_cache_job* job) {
+    if(job->key == 0) return;
+
+    // The depfile goes first, an entry counts as present once its object is there
+    if(job->depfile && !_nocc_cache_store_file(job->depfile, job->key, ".d")) return;
+    _nocc_cache_store_file(job->output, job->key, ".o");
+}
+
+// Cache End ==============================================================
+
+// Compilation Database Begin =============================================
+
+// One "file" of compile_commands.json. Entries are kept sorted by file, so the file comes out the same every time.
+typedef struct {
+    char* file;
+    char* output;
+    char* directory;                // NULL for the working directory, set for entries read back that were made elsewhere
+    nocc_darray(char*) arguments;
+    uint64_t hash;
+} _nocc_compdb_entry;
+
+// A generated unity file and the sources it includes, those are what the editor opens
+typedef struct {
+    char* file;
+    nocc_darray(char*) sources;
+} _nocc_compdb_unity;
+
+typedef struct {
+    char* path;
+    char* directory;
+    bool dirty;
+    nocc_darray(_nocc_compdb_entry) entries;
+    nocc_darray(_nocc_compdb_unity) unity;
+} _nocc_compdb_t;
+
+static _nocc_compdb_t _nocc_compdb = {0};
+
+bool nocc_compdb_write(void);
+void _nocc_compdb_atexit(void) { nocc_compdb_write(); }
+
+void _nocc_compdb_entry_free(_nocc_compdb_entry* entry) {
+    free(entry->file);
+    free(entry->output);
+    free(entry->directory);
+    for(size_t i = 0; i < nocc_da_size(entry->arguments); i++) free(entry->arguments[i]);
+    nocc_da_free(entry->arguments);
+}
+
+int _nocc_compdb_compare_entries(const void* a, const void* b) {
+    return strcmp(((const _nocc_compdb_entry*)a)->file, ((const _nocc_compdb_entry*)b)->file);
+}
+
+// Reads what compilation databases are made of: arrays, objects and strings. Anything else is skipped over.
+typedef struct {
+    const char* it;
+    const char* end;
+} _nocc_json;
+
+void _nocc_json_skip_whitespace(_nocc_json* json) {
+    while(json->it < json->end && (*json->it == ' ' || *json->it == '\t' || *json->it == '\r' || *json->it == '\n')) json->it++;
+}
+
+bool _nocc_json_expect(_nocc_json* json, char c) {
+    _nocc_json_skip_whitespace(json);
+    if(json->it >= json->end || *json->it != c) return false;
+    json->it++;
+    return true;
+}
+
+bool _nocc_json_peek(_nocc_json* json, char c) {
+    _nocc_json_skip_whitespace(json);
+    return json->it < json->end && *json->it == c;
+}
+
+// Unescapes the string into `out` (NULL terminated), or only skips it when `out` is NULL
+bool _nocc_json_string(_nocc_json* json, nocc_string* out) {
+    if(!_nocc_json_expect(json, '"')) return false;
+    while(json->it < json->end && *json->it != '"') {
+        char c = *json->it++;
+        if(c == '\\') {
+            if(json->it >= json->end) return false;
+            c = *json->it++;
+            switch(c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': {
+                if(json->end - json->it < 4) return false;
+                char hex[5] = { json->it[0], json->it[1], json->it[2], json->it[3], '\0' };
+                unsigned long code = strtoul(hex, NULL, 16);
+                json->it += 4;
+                if(out == NULL) continue;
+                // Written as UTF-8, surrogate pairs are not combined
+                if(code < 0x80) {
+                    nocc_str_push_char(*out, (char)code);
+                } else if(code < 0x800) {
+                    nocc_str_push_char(*out, (char)(0xC0 | (code >> 6)));
+                    nocc_str_push_char(*out, (char)(0x80 | (code & 0x3F)));
+                } else {
+                    nocc_str_push_char(*out, (char)(0xE0 | (code >> 12)));
+                    nocc_str_push_char(*out, (char)(0x80 | ((code >> 6) & 0x3F)));
+                    nocc_str_push_char(*out, (char)(0x80 | (code & 0x3F)));
+                }
+                continue;
+            }
+            default: break;
+            }
+        }
+        if(out) nocc_str_push_char(*out, c);
+    }
+    if(json->it >= json->end) return false;
+    json->it++;
+    if(out) nocc_str_push_null(*out);
+    return true;
+}
+
+bool _nocc_json_skip_value(_nocc_json* json) {
+    _nocc_json_skip_whitespace(json);
+    if(json->it >= json->end) return false;
+
+    char c = *json->it;
+    if(c == '"') return _nocc_json_string(json, NULL);
+    if(c == '[' || c == '{') {
+        char close = c == '[' ? ']' : '}';
+        json->it++;
+        if(_nocc_json_expect(json, close)) return true;
+        do {
+            if(close == '}' && (!_nocc_json_string(json, NULL) || !_nocc_json_expect(json, ':'))) return false;
+            if(!_nocc_json_skip_value(json)) return false;
+        } while(_nocc_json_expect(json, ','));
+        return _nocc_json_expect(json, close);
+    }
+
+    // A number, true, false or null
+    const char* start = json->it;
+    while(json->it < json->end && strchr(",]} \t\r\n", *json->it) == NULL) json->it++;
+    return json->it > start;
+}
+
+// Splits a "command" the way a shell would, for entries that have no "arguments"
+void _nocc_compdb_split_command(const char* command, nocc_darray(char*)* arguments) {
+    const char* it = command;
+    for(;;) {
+        while(*it == ' ' || *it == '\t' || *it == '\n') it++;
+        if(*it == '\0') break;
+
+        nocc_string arg = nocc_str_create();
+        char quote = '\0';
+        for(; *it != '\0'; it++) {
+            if(quote == '\0' && (*it == ' ' || *it == '\t' || *it == '\n')) break;
+            if(quote == '\0' && (*it == '"' || *it == '\'')) { quote = *it; continue; }
+            if(quote != '\0' && *it == quote) { quote = '\0'; continue; }
+            if(*it == '\\' && quote != '\'' && it[1] != '\0') it++;
+            nocc_str_push_char(arg, *it);
+        }
+        nocc_str_push_null(arg);
+        nocc_da_push(*arguments, strdup(arg));
+        nocc_str_free(arg);
+    }
+}
+
+// Whether the source of an entry read back still exists, relative to the directory of the entry
+bool _nocc_compdb_source_exists(const char* directory, const char* file) {
+    nocc_string path = nocc_str_create();
+    bool absolute = file[0] == '/' || file[0] == '\\' || (file[0] != '\0' && file[1] == ':');
+    if(!absolute && directory) {
+        nocc_str_push_cstr(path, directory);
+        nocc_str_push_char(path, '/');
+    }
+    nocc_str_push_cstr(path, file);
+    nocc_str_push_null(path);
+
+    nocc_file_info info;
+    bool exists = nocc_get_file_info(path, &info);
+    nocc_str_free(path);
+    return exists;
+}
+
+// Reads the value of one key of an entry read back
+bool _nocc_compdb_read_field(_nocc_json* json, const char* key, _nocc_compdb_entry* entry, char** command) {
+    char** field = NULL;
+    if(strcmp(key, "file") == 0)            field = &entry->file;
+    else if(strcmp(key, "output") == 0)     field = &entry->output;
+    else if(strcmp(key, "directory") == 0)  field = &entry->directory;
+    else if(strcmp(key, "command") == 0)    field = command;
+    if(field == NULL && strcmp(key, "arguments") != 0) return _nocc_json_skip_value(json);
+
+    nocc_string value = nocc_str_create();
+    bool valid;
+    if(field) {
+        valid = _nocc_json_string(json, &value);
+        if(valid) {
+            free(*field);
+            *field = strdup(value);
+        }
+    } else {
+        valid = _nocc_json_expect(json, '[');
+        if(valid && !_nocc_json_expect(json, ']')) {
+            do {
+                nocc_da_clear(value);
+                valid = _nocc_json_string(json, &value);
+                if(valid) nocc_da_push(entry->arguments, strdup(value));
+            } while(valid && _nocc_json_expect(json, ','));
+            valid = valid && _nocc_json_expect(json, ']');
+        }
+    }
+    nocc_str_free(value);
+    return valid;
+}
+
+// While loading, the hash holds the position in the file, so the last entry of a file can win like it does for clangd
+int _nocc_compdb_compare_loaded(const void* a, const void* b) {
+    const _nocc_compdb_entry* x = a;
+    const _nocc_compdb_entry* y = b;
+    int order = strcmp(x->file, y->file);
+    if(order != 0) return order;
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+// Reads the entries of the existing file back, so a build that only gets to some of the targets keeps the rest.
+// Entries of sources that no longer exist are dropped.
+bool _nocc_compdb_load(void) {
+    size_t size = 0;
+    char* data = nocc_read_entire_file(_nocc_compdb.path, &size);
+    if(data == NULL) return true;
+
+    _nocc_json json = { .it = data, .end = data + size };
+    bool valid = _nocc_json_expect(&json, '[');
+    if(valid && !_nocc_json_expect(&json, ']')) {
+        do {
+            _nocc_compdb_entry entry = { .file = NULL, .output = NULL, .directory = NULL, .arguments = nocc_da_create(char*), .hash = 0 };
+            char* command = NULL;
+            valid = _nocc_json_expect(&json, '{');
+            if(valid && !_nocc_json_expect(&json, '}')) {
+                do {
+                    nocc_string key = nocc_str_create();
+                    valid = _nocc_json_string(&json, &key) && _nocc_json_expect(&json, ':') && _nocc_compdb_read_field(&json, key, &entry, &command);
+                    nocc_str_free(key);
+                } while(valid && _nocc_json_expect(&json, ','));
+                valid = valid && _nocc_json_expect(&json, '}');
+            }
+
+            if(command && nocc_da_size(entry.arguments) == 0) _nocc_compdb_split_command(command, &entry.arguments);
+            free(command);
+            if(entry.directory && strcmp(entry.directory, _nocc_compdb.directory) == 0) {
+                free(entry.directory);
+                entry.directory = NULL;
+            }
+
+            if(valid && entry.file && nocc_da_size(entry.arguments) > 0 && _nocc_compdb_source_exists(entry.directory, entry.file)) {
+                entry.hash = nocc_da_size(_nocc_compdb.entries);
+                nocc_da_push(_nocc_compdb.entries, entry);
+            } else {
+                _nocc_compdb_entry_free(&entry);
+            }
+        } while(valid && _nocc_json_expect(&json, ','));
+        valid = valid && _nocc_json_expect(&json, ']');
+    }
+    free(data);
+
+    size_t count = nocc_da_size(_nocc_compdb.entries);
+    if(!valid) {
+        nocc_warn("Ignoring invalid compilation database %s", _nocc_compdb.path);
+        for(size_t i = 0; i < count; i++) _nocc_compdb_entry_free(&_nocc_compdb.entries[i]);
+        nocc_da_clear(_nocc_compdb.entries);
+        return false;
+    }
+
+    qsort(_nocc_compdb.entries, count, sizeof(_nocc_compdb_entry), _nocc_compdb_compare_loaded);
+    size_t unique = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(unique > 0 && strcmp(_nocc_compdb.entries[unique - 1].file, _nocc_compdb.entries[i].file) == 0) {
+            _nocc_compdb_entry_free(&_nocc_compdb.entries[unique - 1]);
+            unique--;
+        }
+        _nocc_compdb.entries[unique] = _nocc_compdb.entries[i];
+        _nocc_compdb.entries[unique].hash = nocc_cmd_hash((nocc_darray(const char*))_nocc_compdb.entries[unique].arguments);
+        unique++;
+    }
+    while(nocc_da_size(_nocc_compdb.entries) > unique) nocc_da_remove(_nocc_compdb.entries, nocc_da_size(_nocc_compdb.entries) - 1, NULL);
+    return true;
+}
+
+/**
+ * @brief Collects the compile commands of the graphs nocc builds (up to date or not) into a compilation database for
+ * clangd and clang-tidy. The entries already in the file are read back and kept, so a build that stops early or
+ * only looks at some targets does not drop the others. Sources of unity files get the command of their unity file.
+ * The file is written after every nocc_graph_build and at exit, and only if an entry changed.
+ * 
+ * @param {const char*} path -- usually "compile_commands.json" at the root of the project
+ * 
+ * @return {void}
+*/
+void nocc_compdb_enable(const char* path) {
+    if(_nocc_compdb.path == NULL) {
+        char cwd[4096] = "";
+#ifdef _WIN32
+        _getcwd(cwd, sizeof(cwd));
+#else
+        if(getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+#endif // _WIN32
+        _nocc_compdb.directory = strdup(cwd);
+        _nocc_compdb.entries = nocc_da_create(_nocc_compdb_entry);
+        _nocc_compdb.unity = nocc_da_create(_nocc_compdb_unity);
+        atexit(_nocc_compdb_atexit);
+    } else {
+        if(strcmp(_nocc_compdb.path, path) == 0) return;
+        nocc_compdb_write();
+        for(size_t i = 0; i < nocc_da_size(_nocc_compdb.entries); i++) _nocc_compdb_entry_free(&_nocc_compdb.entries[i]);
+        nocc_da_clear(_nocc_compdb.entries);
+        free(_nocc_compdb.path);
+    }
+
+    _nocc_compdb.path = strdup(path);
+    _nocc_compdb.dirty = true;
+    _nocc_compdb_load();
+}
+
+// The source file a command compiles, NULL for anything else (e.g. a link)
+const char* _nocc_compdb_source(nocc_darray(const char*) cmd) {
+    static const char* extensions[] = { "c", "cc", "cpp", "cxx", "c++", "m", "mm", "s", "S", "cu" };
+    for(size_t i = 1; i < nocc_da_size(cmd); i++) {
+        const char* arg = cmd[i];
+        if(strcmp(arg, "-o") == 0 || strcmp(arg, "-MF") == 0 || strcmp(arg, "-MT") == 0 || strcmp(arg, "-MQ") == 0) { i++; continue; }
+        if(arg[0] == '-') continue;
+
+        const char* dot = strrchr(arg, '.');
+        if(dot == NULL) continue;
+        for(size_t j = 0; j < sizeof(extensions) / sizeof(extensions[0]); j++) {
+            if(strcmp(dot + 1, extensions[j]) == 0) return arg;
+        }
+    }
+    return NULL;
+}
+
+// Adds or updates the entry of the file
+void _nocc_compdb_put(const char* file, nocc_darray(const char*) cmd) {
+    size_t low = 0, high = nocc_da_size(_nocc_compdb.entries);
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(strcmp(file, _nocc_compdb.entries[middle].file) > 0) low = middle + 1;
+        else                                                    high = middle;
+    }
+
+    uint64_t hash = nocc_cmd_hash(cmd);
+    _nocc_compdb_entry* entry = &_nocc_compdb.entries[low];
+    bool found = low < nocc_da_size(_nocc_compdb.entries) && strcmp(file, entry->file) == 0;
+    if(found && entry->hash == hash && entry->directory == NULL) return;
+
+    const char* output = _nocc_cmd_arg_value(cmd, "-o");
+    if(!found) {
+        _nocc_compdb_entry empty = { .file = strdup(file), .output = NULL, .directory = NULL, .arguments = NULL, .hash = 0 };
+        nocc_da_push(_nocc_compdb.entries, empty);
+        entry = &_nocc_compdb.entries[low];
+        memmove(entry + 1, entry, (nocc_da_size(_nocc_compdb.entries) - low - 1) * sizeof(_nocc_compdb_entry));
+        *entry = empty;
+    } else {
+        for(size_t i = 0; i < nocc_da_size(entry->arguments); i++) free(entry->arguments[i]);
+        nocc_da_free(entry->arguments);
+        free(entry->output);
+        free(entry->directory);
+        entry->directory = NULL;
+    }
+
+    entry->output = output ? strdup(output) : NULL;
+    entry->arguments = nocc_da_reserve(char*, nocc_da_size(cmd) + 1);
+    for(size_t i = 0; i < nocc_da_size(cmd); i++) {
+        char* arg = strdup(cmd[i]);
+        nocc_da_push(entry->arguments, arg);
+    }
+    entry->hash = hash;
+    _nocc_compdb.dirty = true;
+}
+
+// Adds or updates the entry of a compile command, anything that is not a compile is ignored.
+// The command of a unity file goes to each of its sources instead, compiling that source.
+void _nocc_compdb_record(nocc_darray(const char*) cmd) {
+    if(_nocc_compdb.path == NULL) return;
+    const char* file = _nocc_compdb_source(cmd);
+    if(file == NULL) return;
+
+    const _nocc_compdb_unity* unity = NULL;
+    for(size_t i = 0; i < nocc_da_size(_nocc_compdb.unity) && unity == NULL; i++) {
+        if(strcmp(_nocc_path_skip_dot(_nocc_compdb.unity[i].file), _nocc_path_skip_dot(file)) == 0) unity = &_nocc_compdb.unity[i];
+    }
+    if(unity == NULL) {
+        _nocc_compdb_put(file, cmd);
+        return;
+    }
+
+    nocc_darray(const char*) source_cmd = nocc_da_reserve(const char*, nocc_da_size(cmd) + 1);
+    for(size_t i = 0; i < nocc_da_size(unity->sources); i++) {
+        nocc_da_clear(source_cmd);
+        for(size_t j = 0; j < nocc_da_size(cmd); j++) {
+            const char* arg = cmd[j] == file ? unity->sources[i] : cmd[j];
+            nocc_da_push(source_cmd, arg);
+        }
+        _nocc_compdb_put(unity->sources[i], source_cmd);
+    }
+    nocc_da_free(source_cmd);
+}
+
+// Remembers which sources the unity file includes, see nocc_unity_generate
+void _nocc_compdb_unity_sources(const char* file, const char** sources, size_t count) {
+    if(_nocc_compdb.path == NULL) return;
+
+    _nocc_compdb_unity* unity = NULL;
+    for(size_t i = 0; i < nocc_da_size(_nocc_compdb.unity) && unity == NULL; i++) {
+        if(strcmp(_nocc_compdb.unity[i].file, file) == 0) unity = &_nocc_compdb.unity[i];
+    }
+    if(unity == NULL) {
+        _nocc_compdb_unity empty = { .file = strdup(file), .sources = nocc_da_create(char*) };
+        nocc_da_push(_nocc_compdb.unity, empty);
+        unity = &_nocc_compdb.unity[nocc_da_size(_nocc_compdb.unity) - 1];
+    }
+
+    for(size_t i = 0; i < nocc_da_size(unity->sources); i++) free(unity->sources[i]);
+    nocc_da_clear(unity->sources);
+    for(size_t i = 0; i < count; i++) nocc_da_push(unity->sources, strdup(sources[i]));
+}
+
+// Where the JSON goes: compared against what is on disk, or written to a file
+typedef struct {
+    FILE* file;
+    const char* existing;
+    size_t existing_size;
+    size_t offset;
+    bool equal;
+} _nocc_compdb_sink;
+
+void _nocc_compdb_emit(_nocc_compdb_sink* sink, const char* data, size_t size) {
+    if(sink->file) {
+        fwrite(data, 1, size, sink->file);
+        return;
+    }
+    if(!sink->equal) return;
+    if(sink->offset + size > sink->existing_size || memcmp(sink->existing + sink->offset, data, size) != 0) sink->equal = false;
+    sink->offset += size;
+}
+
+void _nocc_compdb_emit_cstr(_nocc_compdb_sink* sink, const char* str) {
+    _nocc_compdb_emit(sink, str, strlen(str));
+}
+
+void _nocc_compdb_emit_string(_nocc_compdb_sink* sink, const char* str) {
+    _nocc_compdb_emit(sink, "\"", 1);
+    const char* run = str;
+    for(const char* it = str; ; it++) {
+        unsigned char c = (unsigned char)*it;
+        if(c != '\0' && c != '"' && c != '\\' && c >= 0x20) continue;
+
+        _nocc_compdb_emit(sink, run, (size_t)(it - run));
+        if(c == '\0') break;
+        char escaped[8];
+        if(c == '"' || c == '\\') snprintf(escaped, sizeof(escaped), "\\%c", c);
+        else                      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        _nocc_compdb_emit_cstr(sink, escaped);
+        run = it + 1;
+    }
+    _nocc_compdb_emit(sink, "\"", 1);
+}
+
+void _nocc_compdb_emit_all(_nocc_compdb_sink* sink) {
+    _nocc_compdb_emit_cstr(sink, "[");
+    for(size_t i = 0; i < nocc_da_size(_nocc_compdb.entries); i++) {
+        _nocc_compdb_entry* entry = &_nocc_compdb.entries[i];
+        _nocc_compdb_emit_cstr(sink, i == 0 ? "\n  {\n    \"directory\": " : ",\n  {\n    \"directory\": ");
+        _nocc_compdb_emit_string(sink, entry->directory ? entry->directory : _nocc_compdb.directory);
+        _nocc_compdb_emit_cstr(sink, ",\n    \"file\": ");
+        _nocc_compdb_emit_string(sink, entry->file);
+        if(entry->output) {
+            _nocc_compdb_emit_cstr(sink, ",\n    \"output\": ");
+            _nocc_compdb_emit_string(sink, entry->output);
+        }
+        _nocc_compdb_emit_cstr(sink, ",\n    \"arguments\": [");
+        for(size_t j = 0; j < nocc_da_size(entry->arguments); j++) {
+            if(j > 0) _nocc_compdb_emit_cstr(sink, ", ");
+            _nocc_compdb_emit_string(sink, entry->arguments[j]);
+        }
+        _nocc_compdb_emit_cstr(sink, "]\n  }");
+    }
+    _nocc_compdb_emit_cstr(sink, "\n]\n");
+}
+
+/**
+ * @brief Writes the compilation database if an entry changed. The JSON is first compared against the file
+ * on disk and only streamed to it if it differs, so indexers watching the file do not reparse the project for nothing.
+ * 
+ * @return {bool} false if the file could not be written.
+*/
+bool nocc_compdb_write(void) {
+    if(_nocc_compdb.path == NULL || !_nocc_compdb.dirty) return true;
+
+    size_t size = 0;
+    char* existing = nocc_read_entire_file(_nocc_compdb.path, &size);
+    _nocc_compdb_sink compare = { .file = NULL, .existing = existing, .existing_size = size, .offset = 0, .equal = existing != NULL };
+    _nocc_compdb_emit_all(&compare);
+    bool equal = compare.equal && compare.offset == size;
+    free(existing);
+    if(equal) {
+        _nocc_compdb.dirty = false;
+        return true;
+    }
+
+    nocc_string tmp = nocc_str_create();
+    nocc_str_push_cstr(tmp, _nocc_compdb.path);
+    nocc_str_push_cstr(tmp, ".tmp");
+    nocc_str_push_null(tmp);
+
+    bool status = false;
+    FILE* file = fopen(tmp, "wb");
+    if(file == NULL) {
+        nocc_error("Could not write %s: %s", tmp, strerror(errno));
+    } else {
+        _nocc_compdb_sink sink = { .file = file, .existing = NULL, .existing_size = 0, .offset = 0, .equal = false };
+        _nocc_compdb_emit_all(&sink);
+        status = !ferror(file);
+        if(fclose(file) != 0) status = false;
+        // Renaming keeps readers from seeing half a file
+        status = status && _nocc_rename_file(tmp, _nocc_compdb.path);
+        if(!status) remove(tmp);
+    }
+
+    if(status) {
+        nocc_stat_cache_invalidate(_nocc_compdb.path);
+        _nocc_compdb.dirty = false;
+    }
+    nocc_str_free(tmp);
+    return status;
+}
+
+// Compilation Database End ===============================================
+
+// Directory Cache Begin ==================================================
+
+#define _NOCC_DIR_CACHE_MAGIC       "NOCCDIR2"
+// A listing read this soon after its directory changed may have missed a second change within the same timestamp tick
+#define _NOCC_DIR_CACHE_RACY_NS     (2 * 1000000000LL)
+
+// What has to stay the same for a listing to be reused. Any entry added, removed or renamed changes the mtime.
+typedef struct {
+    uint64_t dev, ino;
+    int64_t mtime;
+} _nocc_dir_stamp;
+
+typedef struct {
+    char* path;
+    _nocc_dir_stamp stamp;
+    int64_t listed_at;              // same clock as the mtime
+    nocc_string names;
+    nocc_darray(_nocc_dir_entry) entries;
+    bool used;                      // by a scan of this run, only those are saved
+} _nocc_dir_record;
+
+// On disk after the magic and the record count, followed by the path, the names and one type byte per entry
+typedef struct {
+    uint32_t path_length, names_size, entry_count, reserved;
+    uint64_t dev, ino;
+    int64_t mtime, listed_at;
+} _nocc_dir_record_header;
+
+typedef struct {
+    char* path;
+    nocc_darray(_nocc_dir_record) records;      // sorted by path
+    bool scanned;
+    bool dirty;
+} _nocc_dir_cache_t;
+
+static _nocc_dir_cache_t _nocc_dir_cache = {0};
+
+bool _nocc_dir_stamp_of(const char* dir, _nocc_dir_stamp* stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+#ifdef _WIN32
+    nocc_file_info info;
+    if(!_nocc_stat_uncached(dir, &info)) return false;
+    stamp->mtime = info.mtime;
+#else
+    struct stat statbuf;
+    if(stat(dir, &statbuf) < 0) return false;
+    stamp->dev = (uint64_t)statbuf.st_dev;
+    stamp->ino = (uint64_t)statbuf.st_ino;
+    #ifdef __APPLE__
+    stamp->mtime = (int64_t)statbuf.st_mtimespec.tv_sec * 1000000000 + statbuf.st_mtimespec.tv_nsec;
+    #else
+    stamp->mtime = (int64_t)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+    #endif // __APPLE__
+#endif // _WIN32
+    return true;
+}
+
+void _nocc_dir_record_free(_nocc_dir_record* record) {
+    free(record->path);
+    nocc_str_free(record->names);
+    nocc_da_free(record->entries);
+}
+
+int _nocc_dir_record_compare(const void* a, const void* b) {
+    return strcmp(((const _nocc_dir_record*)a)->path, ((const _nocc_dir_record*)b)->path);
+}
+
+_nocc_dir_record* _nocc_dir_cache_find(const char* path) {
+    if(_nocc_dir_cache.records == NULL) return NULL;
+    _nocc_dir_record key = { .path = (char*)path };
+    return bsearch(&key, _nocc_dir_cache.records, nocc_da_size(_nocc_dir_cache.records), sizeof(_nocc_dir_record), _nocc_dir_record_compare);
+}
+
+bool _nocc_dir_cache_fresh(const _nocc_dir_record* record, const _nocc_dir_stamp* stamp) {
+    return record->stamp.dev == stamp->dev && record->stamp.ino == stamp->ino && record->stamp.mtime == stamp->mtime
+        && record->listed_at - stamp->mtime > _NOCC_DIR_CACHE_RACY_NS;
+}
+
+bool _nocc_dir_cache_load(const char* filepath) {
+    size_t size = 0;
+    char* data = nocc_read_entire_file(filepath, &size);
+    if(data == NULL) return true;
+
+    uint64_t count = 0;
+    bool valid = size >= 16 && memcmp(data, _NOCC_DIR_CACHE_MAGIC, 8) == 0;
+    if(valid) memcpy(&count, data + 8, sizeof(uint64_t));
+
+    size_t offset = 16;
+    for(uint64_t i = 0; i < count && valid; i++) {
+        _nocc_dir_record_header header;
+        valid = size - offset >= sizeof(header);
+        if(!valid) break;
+        memcpy(&header, data + offset, sizeof(header));
+        offset += sizeof(header);
+
+        uint64_t length = (uint64_t)header.path_length + header.names_size + header.entry_count;
+        valid = size - offset >= length;
+        if(!valid) break;
+
+        _nocc_dir_record record = {
+            .stamp = { .dev = header.dev, .ino = header.ino, .mtime = header.mtime },
+            .listed_at = header.listed_at,
+            .names = nocc_str_reserve(header.names_size + 1),
+            .entries = nocc_da_reserve(_nocc_dir_entry, header.entry_count + 1),
+        };
+        record.path = malloc(header.path_length + 1);
+        memcpy(record.path, data + offset, header.path_length);
+        record.path[header.path_length] = '\0';
+        offset += header.path_length;
+
+        if(header.names_size > 0) nocc_da_pushn(record.names, header.names_size, data + offset);
+        const char* types = data + offset + header.names_size;
+        size_t name = 0;
+        for(uint32_t j = 0; j < header.entry_count && valid; j++) {
+            valid = name < header.names_size;
+            if(!valid) break;
+            _nocc_dir_entry entry = { .name = name, .type = (nocc_file_type)types[j] };
+            nocc_da_push(record.entries, entry);
+            name += strnlen(record.names + name, header.names_size - name) + 1;
+        }
+        offset += header.names_size + header.entry_count;
+
+        nocc_da_push(_nocc_dir_cache.records, record);
+    }
+    valid = valid && offset == size;
+    free(data);
+
+    if(!valid) {
+        nocc_warn("Ignoring invalid directory cache %s", filepath);
+        for(size_t i = 0; i < nocc_da_size(_nocc_dir_cache.records); i++) _nocc_dir_record_free(&_nocc_dir_cache.records[i]);
+        nocc_da_clear(_nocc_dir_cache.records);
+        return false;
+    }
+    qsort(_nocc_dir_cache.records, nocc_da_size(_nocc_dir_cache.records), sizeof(_nocc_dir_record), _nocc_dir_record_compare);
+    return true;
+}
+
+// Takes the listings the scan had to read, they replace the ones that were outdated
+void _nocc_dir_cache_merge(nocc_darray(_nocc_dir_record) fresh) {
+    _nocc_dir_cache.scanned = true;
+    if(nocc_da_size(fresh) == 0) return;
+
+    // New directories are appended only once every lookup is done, the binary search needs the records sorted
+    size_t added = 0;
+    for(size_t i = 0; i < nocc_da_size(fresh); i++) {
+        _nocc_dir_record* record = _nocc_dir_cache_find(fresh[i].path);
+        if(record) {
+            _nocc_dir_record_free(record);
+            *record = fresh[i];
+        } else {
+            fresh[added++] = fresh[i];
+        }
+    }
+    if(added > 0) nocc_da_pushn(_nocc_dir_cache.records, added, fresh);
+    qsort(_nocc_dir_cache.records, nocc_da_size(_nocc_dir_cache.records), sizeof(_nocc_dir_record), _nocc_dir_record_compare);
+    _nocc_dir_cache.dirty = true;
+}
+
+/**
+ * @brief Writes the directory cache back, if a scan read a directory or stopped seeing one. The file is replaced atomically.
+ * 
+ * @return {bool} false if the file could not be written.
+*/
+bool nocc_dir_cache_save(void) {
+    if(_nocc_dir_cache.path == NULL || !_nocc_dir_cache.scanned) return true;
+
+    // Directories no scan went through anymore (deleted, or excluded now) are dropped
+    uint64_t count = 0;
+    for(size_t i = 0; i < nocc_da_size(_nocc_dir_cache.records); i++) {
+        if(_nocc_dir_cache.records[i].used) count++;
+        else _nocc_dir_cache.dirty = true;
+    }
+    if(!_nocc_dir_cache.dirty) return true;
+
+    nocc_string tmp = nocc_str_create();
+    nocc_str_push_cstr(tmp, _nocc_dir_cache.path);
+    nocc_str_push_cstr(tmp, ".tmp");
+    nocc_str_push_null(tmp);
+
+    bool status = false;
+    FILE* file = fopen(tmp, "wb");
+    if(file == NULL) {
+        nocc_error("Could not write %s: %s", tmp, strerror(errno));
+        goto done;
+    }
+
+    fwrite(_NOCC_DIR_CACHE_MAGIC, 1, 8, file);
+    fwrite(&count, sizeof(uint64_t), 1, file);
+    for(size_t i = 0; i < nocc_da_size(_nocc_dir_cache.records); i++) {
+        _nocc_dir_record* record = &_nocc_dir_cache.records[i];
+        if(!record->used) continue;
+
+        _nocc_dir_record_header header = {
+            .path_length = (uint32_t)strlen(record->path), .names_size = (uint32_t)nocc_da_size(record->names),
+            .entry_count = (uint32_t)nocc_da_size(record->entries), .dev = record->stamp.dev, .ino = record->stamp.ino,
+            .mtime = record->stamp.mtime, .listed_at = record->listed_at,
+        };
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(record->path, 1, header.path_length, file);
+        fwrite(record->names, 1, header.names_size, file);
+        for(uint32_t j = 0; j < header.entry_count; j++) fputc((int)record->entries[j].type, file);
+    }
+    // Only a complete file is renamed over the old cache
+    bool written = !ferror(file);
+    status = fclose(file) == 0 && written && _nocc_rename_file(tmp, _nocc_dir_cache.path);
+    if(status) {
+        _nocc_dir_cache.dirty = false;
+    } else {
+        nocc_error("Could not save the directory cache %s", _nocc_dir_cache.path);
+        remove(tmp);
+    }
+
+done:
+    nocc_str_free(tmp);
+    return status;
+}
+
+void _nocc_dir_cache_atexit(void) {
+    nocc_dir_cache_save();
+    for(size_t i = 0; i < nocc_da_size(_nocc_dir_cache.records); i++) _nocc_dir_record_free(&_nocc_dir_cache.records[i]);
+    nocc_da_free(_nocc_dir_cache.records);
+    free(_nocc_dir_cache.path);
+    _nocc_dir_cache = (_nocc_dir_cache_t){0};
+}
+
+/**
+ * @brief Remembers the listing of every directory nocc_read_dir goes through, together with the directory's inode and mtime.
+ * The next run only stats a directory that did not change instead of reading it again, so finding the sources of a large
+ * tree costs one stat per directory. The file is written at exit.
+ * 
+ * @param {const char*} filepath -- the cache, e.g. "./.nocc_dirs"
+ * 
+ * @return {bool} false if the file exists but is not a directory cache, the scans start from scratch then.
+*/
+bool nocc_dir_cache_enable(const char* filepath) {
+    bool first = _nocc_dir_cache.path == NULL;
+    free(_nocc_dir_cache.path);
+    _nocc_dir_cache.path = strdup(filepath);
+    if(!first) return true;
+
+    _nocc_dir_cache.records = nocc_da_create(_nocc_dir_record);
+    atexit(_nocc_dir_cache_atexit);
+    return _nocc_dir_cache_load(filepath);
+}
+
+// Directory Cache End ====================================================
+
+// Jobs Begin =============================================================
+
+/**
+ * @brief A single slot of the job pool. `pid` is NOCC_INVALID_PID while the slot is free.
+*/
+typedef struct {
+    pid pid;
+    void* user_data;
+    int exit_code;
+    size_t weight;          // the amount of slots the job counts as
+    int64_t start, end;     // nocc_now_ns() when the job was started and reaped
+
+    // internal
+    _nocc_cache_job* _cache;
+    char* _outputs[2];      // -o and -MF of the command, dropped from the stat cache when the job finishes
+    int _pipes[2];          // read ends of the pipes the process writes its stdout and stderr to, -1 if it inherits ours
+    int _pidfd;             // becomes readable once the process exits, -1 if the kernel has no pidfd_open
+    nocc_string _printed[2];    // what the process printed to stdout and stderr, each written out in one piece when it finishes
+    size_t _trace_name;     // offsets into the trace strings, SIZE_MAX when not tracing
+    size_t _trace_args;
+} nocc_job;
+
+/**
+ * @brief A pool of commands running at the same time. The weights of the jobs in flight add up to at most `max_jobs`,
+ * submitting more blocks until one of the running ones finishes. See nocc_jobs_limit for holding back on a busy machine.
+ * On Linux the stdout and stderr of every job are captured and each printed in one piece to ours when the job finishes,
+ * so the diagnostics of parallel compiles do not interleave. Elsewhere jobs print straight to the console.
+*/
+typedef struct {
+    size_t max_jobs;
+    size_t running;
+    size_t failed;
+    size_t weight;          // the weights of the running jobs added up
+    double max_load;        // no new jobs while the load average is above this, 0 turns it off
+    uint64_t min_memory;    // no new jobs while less memory (in bytes) is available, 0 turns it off
+    nocc_darray(nocc_job) slots;
+
+    // internal
+    int _epoll;             // waits on the pipes and pidfds of all jobs, -1 without epoll
+    int64_t _sampled_at;    // nocc_now_ns() of the last look at the load and memory
+    bool _overloaded;
+    bool _cancelled;        // the running jobs were killed, what they leave behind is removed
+} nocc_jobs;
+
+#ifndef _WIN32
+// Jobs run in process groups of their own (so they can be killed with their children), which keeps Ctrl-C from reaching them.
+// nocc catches the signal instead, kills the jobs, cleans up after them and then dies of the signal itself.
+static volatile sig_atomic_t _nocc_jobs_signal = 0;
+static volatile sig_atomic_t _nocc_jobs_in_flight = 0;
+
+void _nocc_jobs_on_signal(int sig) {
+    if(_nocc_jobs_in_flight == 0) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+    _nocc_jobs_signal = sig;
+}
+
+void _nocc_jobs_install_signals(void) {
+    static bool installed = false;
+    if(installed) return;
+    installed = true;
+
+    int signals[] = { SIGINT, SIGTERM, SIGHUP };
+    for(size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        struct sigaction previous;
+        if(sigaction(signals[i], NULL, &previous) != 0 || previous.sa_handler != SIG_DFL) continue;
+
+        // No SA_RESTART, waiting for the jobs has to wake up
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = _nocc_jobs_on_signal;
+        sigemptyset(&action.sa_mask);
+        sigaction(signals[i], &action, NULL);
+    }
+}
+#endif // _WIN32
+
+/**
+ * @brief returns the number of online CPUs, or 1 if it cannot be determined.
+ * 
+ * @return {size_t}
+*/
+size_t nocc_nprocs(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif // _WIN32
+}
+
+/**
+ * @brief Initializes the job pool.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool to initialize
+ * @param {size_t} max_jobs -- the amount of processes allowed to run at once. 0 means nocc_nprocs().
+ * On Windows it is capped at MAXIMUM_WAIT_OBJECTS (64), the most processes a single wait can watch.
+ * 
+ * @return {void}
+*/
+void nocc_jobs_init(nocc_jobs* jobs, size_t max_jobs) {
+    if(max_jobs == 0) max_jobs = nocc_nprocs();
+#ifdef _WIN32
+    // A job in a slot past the ones WaitForMultipleObjects watches would only be reaped once another one exits
+    if(max_jobs > MAXIMUM_WAIT_OBJECTS) max_jobs = MAXIMUM_WAIT_OBJECTS;
+#endif // _WIN32
+
+    jobs->max_jobs = max_jobs;
+    jobs->running = 0;
+    jobs->failed = 0;
+    jobs->weight = 0;
+    jobs->max_load = 0;
+    jobs->min_memory = 0;
+    jobs->_sampled_at = 0;
+    jobs->_overloaded = false;
+    jobs->_cancelled = false;
+    jobs->slots = nocc_da_reserve(nocc_job, max_jobs);
+    for(size_t i = 0; i < max_jobs; i++) {
+        nocc_job empty = { .pid = NOCC_INVALID_PID, .user_data = NULL, .exit_code = 0, .weight = 0, .start = 0, .end = 0, ._cache = NULL, ._outputs = { NULL, NULL },
+                           ._pipes = { -1, -1 }, ._pidfd = -1, ._printed = { NULL, NULL }, ._trace_name = SIZE_MAX, ._trace_args = SIZE_MAX };
+        nocc_da_push(jobs->slots, empty);
+    }
+
+#ifdef __linux__
+    jobs->_epoll = epoll_create1(EPOLL_CLOEXEC);
+#else
+    jobs->_epoll = -1;
+#endif // __linux__
+#ifndef _WIN32
+    _nocc_jobs_install_signals();
+#endif // _WIN32
+}
+
+/**
+ * @brief Kills the running jobs, on POSIX their whole process group (e.g. cc1 and as under the compiler driver).
+ * They still have to be reaped with nocc_jobs_wait_any, which removes the outputs (-o and -MF) the killed jobs left half written.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * 
+ * @return {void}
+*/
+void nocc_jobs_kill(nocc_jobs* jobs) {
+    if(jobs->running == 0) return;
+    jobs->_cancelled = true;
+    for(size_t i = 0; i < jobs->max_jobs; i++) {
+        if(jobs->slots[i].pid == NOCC_INVALID_PID) continue;
+#ifdef _WIN32
+        TerminateProcess(jobs->slots[i].pid, 1);
+#else
+        kill(-jobs->slots[i].pid, SIGTERM);
+#endif // _WIN32
+    }
+}
+
+/**
+ * @brief Frees the job pool. Call nocc_jobs_wait_all first, running processes are not waited on.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool to free
+ * 
+ * @return {void}
+*/
+void nocc_jobs_free(nocc_jobs* jobs) {
+    nocc_assert(jobs->running == 0, "Freeing a job pool with %zu jobs still running", jobs->running);
+    for(size_t i = 0; i < jobs->max_jobs; i++) {
+        for(size_t j = 0; j < 2; j++) {
+            if(jobs->slots[i]._printed[j]) nocc_str_free(jobs->slots[i]._printed[j]);
+        }
+    }
+    nocc_da_free(jobs->slots);
+    jobs->slots = NULL;
+#ifndef _WIN32
+    if(jobs->_epoll >= 0) close(jobs->_epoll);
+#endif // _WIN32
+    jobs->_epoll = -1;
+}
+
+/**
+ * @brief Holds back new jobs while the machine is busy, like make -l but for memory as well. At least one job
+ * always runs, so a build makes progress on a machine that is busy with something else.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * @param {double} max_load -- the 1 minute load average (/proc/loadavg) above which no job is started, 0 for no limit. Linux only.
+ * @param {uint64_t} min_memory_mb -- the available memory (MemAvailable of /proc/meminfo) in MiB below which no job is started, 0 for no limit
+ * 
+ * @return {void}
+*/
+void nocc_jobs_limit(nocc_jobs* jobs, double max_load, uint64_t min_memory_mb) {
+    jobs->max_load = max_load;
+    jobs->min_memory = min_memory_mb * 1024 * 1024;
+    jobs->_sampled_at = 0;
+}
+
+// Reads the 1 minute load average and the available memory in bytes. false if they are not known.
+bool _nocc_jobs_machine_state(double* load, uint64_t* available) {
+#ifdef _WIN32
+    MEMORYSTATUSEX status = { .dwLength = sizeof(MEMORYSTATUSEX) };
+    if(!GlobalMemoryStatusEx(&status)) return false;
+    *load = 0;
+    *available = status.ullAvailPhys;
+    return true;
+#else
+    char buffer[4096];
+    *load = 0;
+    *available = UINT64_MAX;
+
+    int fd = open("/proc/loadavg", O_RDONLY);
+    if(fd < 0) return false;
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if(n <= 0) return false;
+    buffer[n] = '\0';
+    *load = strtod(buffer, NULL);
+
+    fd = open("/proc/meminfo", O_RDONLY);
+    if(fd < 0) return true;
+    n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if(n <= 0) return true;
+    buffer[n] = '\0';
+    const char* line = strstr(buffer, "MemAvailable:");
+    if(line) *available = strtoull(line + strlen("MemAvailable:"), NULL, 10) * 1024;
+    return true;
+#endif // _WIN32
+}
+
+// Whether a job of `weight` can start now. Busy machines are checked every 100ms at most.
+bool _nocc_jobs_can_start(nocc_jobs* jobs, size_t weight) {
+    if(jobs->running == 0) return true;
+    if(jobs->running >= jobs->max_jobs || jobs->weight + weight > jobs->max_jobs) return false;
+    if(jobs->max_load <= 0 && jobs->min_memory == 0) return true;
+
+    int64_t now = nocc_now_ns();
+    if(now - jobs->_sampled_at >= 100000000) {
+        jobs->_sampled_at = now;
+        double load;
+        uint64_t available;
+        bool overloaded = false;
+        if(_nocc_jobs_machine_state(&load, &available)) {
+            overloaded = (jobs->max_load > 0 && load > jobs->max_load) || (jobs->min_memory > 0 && available < jobs->min_memory);
+        }
+        if(overloaded && !jobs->_overloaded) nocc_debug("Holding back jobs (load %.2f, %llu MiB available)", load, (unsigned long long)(available >> 20));
+        jobs->_overloaded = overloaded;
+    }
+    return !jobs->_overloaded;
+}
+
+#ifdef __linux__
+// What an epoll event belongs to, kept in the lowest two bits of epoll_data.u64 next to the slot index.
+// The pipes are the index of the stream in nocc_job._pipes.
+#define _NOCC_JOBS_EVENT_STDOUT 0
+#define _NOCC_JOBS_EVENT_STDERR 1
+#define _NOCC_JOBS_EVENT_PIDFD  2
+#define _NOCC_JOBS_EVENT_BITS   2
+
+// Reads what the process of the job wrote to the stream so far. Returns false once the write end is closed.
+bool _nocc_jobs_drain(nocc_job* job, size_t stream) {
+    char buffer[4096];
+    for(;;) {
+        ssize_t n = read(job->_pipes[stream], buffer, sizeof(buffer));
+        if(n > 0) {
+            nocc_da_pushn(job->_printed[stream], (size_t)n, buffer);
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+// Waits for the next job to exit. Level triggered, so events left over in `events` show up again next time.
+// `wait_mask` is the signal mask while blocked in epoll_pwait, the signals the pool handles are blocked everywhere else
+bool _nocc_jobs_reap_epoll_masked(nocc_jobs* jobs, size_t* index_out, int* exit_code_out, const sigset_t* wait_mask) {
+    struct epoll_event events[32];
+    for(;;) {
+        if(_nocc_jobs_signal && !jobs->_cancelled) nocc_jobs_kill(jobs);
+        int count = epoll_pwait(jobs->_epoll, events, 32, -1, wait_mask);
+        if(count < 0) {
+            if(errno == EINTR) continue;
+            nocc_error("Could not wait for child processes: %s", strerror(errno));
+            return false;
+        }
+
+        for(int i = 0; i < count; i++) {
+            size_t index = (size_t)(events[i].data.u64 >> _NOCC_JOBS_EVENT_BITS);
+            size_t kind = (size_t)(events[i].data.u64 & ((1 << _NOCC_JOBS_EVENT_BITS) - 1));
+            nocc_job* job = &jobs->slots[index];
+            if(kind != _NOCC_JOBS_EVENT_PIDFD) {
+                if(job->_pipes[kind] < 0 || _nocc_jobs_drain(job, kind)) continue;
+                close(job->_pipes[kind]);
+                job->_pipes[kind] = -1;
+                // Without a pidfd both pipes closing is the sign the process is done
+                if(job->_pidfd >= 0 || job->_pipes[0] >= 0 || job->_pipes[1] >= 0) continue;
+            } else if(job->_pidfd < 0) {
+                continue;
+            }
+
+            // NOTE: a grandchild can keep the pipes open, only what is already buffered gets read.
+            for(size_t stream = 0; stream < 2; stream++) {
+                if(job->_pipes[stream] < 0) continue;
+                _nocc_jobs_drain(job, stream);
+                close(job->_pipes[stream]);
+                job->_pipes[stream] = -1;
+            }
+            if(job->_pidfd >= 0) {
+                close(job->_pidfd);
+                job->_pidfd = -1;
+            }
+
+            int wstatus = 0;
+            while(waitpid(job->pid, &wstatus, 0) < 0) {
+                if(errno == EINTR) continue;
+                nocc_error("Could not wait for child process %d: %s", (int)job->pid, strerror(errno));
+                break;
+            }
+
+            job->pid = NOCC_INVALID_PID;
+            *index_out = index;
+            *exit_code_out = _nocc_cmd_exit_code(wstatus);
+            return true;
+        }
+    }
+}
+
+// A signal landing between the check of _nocc_jobs_signal and the wait would only be acted on once some job exits.
+// The signals stay blocked until epoll_pwait, which unblocks them atomically while it sleeps.
+bool _nocc_jobs_reap_epoll(nocc_jobs* jobs, size_t* index_out, int* exit_code_out) {
+    sigset_t handled, previous;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTERM);
+    sigaddset(&handled, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &handled, &previous);
+    bool status = _nocc_jobs_reap_epoll_masked(jobs, index_out, exit_code_out, &previous);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return status;
+}
+#endif // __linux__
+
+#ifdef __linux__
+// Creates the pipe for one stream of a job and watches its read end
+bool _nocc_jobs_pipe(nocc_jobs* jobs, size_t index, size_t stream, int fds[2], const char* name) {
+    // Close on exec from the start: a job inheriting the pipe would keep it from closing when this one exits.
+    // NOTE: glibc only declares pipe2 with _GNU_SOURCE.
+    if(syscall(SYS_pipe2, fds, O_CLOEXEC) != 0) {
+        nocc_error("Could not create a pipe for %s: %s", name, strerror(errno));
+        return false;
+    }
+
+    // The pipe is watched before the process starts, a job epoll does not know about would never be reaped
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = ((uint64_t)index << _NOCC_JOBS_EVENT_BITS) | stream };
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    if(epoll_ctl(jobs->_epoll, EPOLL_CTL_ADD, fds[0], &event) != 0) {
+        nocc_error("Could not watch the output of %s: %s", name, strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    return true;
+}
+#endif // __linux__
+
+// Starts the command of a job. With epoll its stdout and stderr go into pipes the pool watches.
+pid _nocc_jobs_spawn(nocc_jobs* jobs, size_t index, nocc_darray(const char*) cmd) {
+#ifdef __linux__
+    if(jobs->_epoll < 0) return _nocc_cmd_spawn(cmd, NULL, -1, -1, true);
+
+    int out[2], err[2];
+    if(!_nocc_jobs_pipe(jobs, index, _NOCC_JOBS_EVENT_STDOUT, out, cmd[0])) return NOCC_INVALID_PID;
+    if(!_nocc_jobs_pipe(jobs, index, _NOCC_JOBS_EVENT_STDERR, err, cmd[0])) {
+        close(out[0]);
+        close(out[1]);
+        return NOCC_INVALID_PID;
+    }
+
+    pid cpid = _nocc_cmd_spawn(cmd, NULL, out[1], err[1], true);
+    close(out[1]);
+    close(err[1]);
+    if(cpid == NOCC_INVALID_PID) {
+        close(out[0]);
+        close(err[0]);
+        return NOCC_INVALID_PID;
+    }
+
+    nocc_job* job = &jobs->slots[index];
+    for(size_t stream = 0; stream < 2; stream++) {
+        if(job->_printed[stream] == NULL) job->_printed[stream] = nocc_str_create();
+    }
+    job->_pipes[0] = out[0];
+    job->_pipes[1] = err[0];
+
+#ifdef SYS_pidfd_open
+    job->_pidfd = (int)syscall(SYS_pidfd_open, cpid, 0);
+#endif // SYS_pidfd_open
+    if(job->_pidfd >= 0) {
+        struct epoll_event event = { .events = EPOLLIN, .data.u64 = ((uint64_t)index << _NOCC_JOBS_EVENT_BITS) | _NOCC_JOBS_EVENT_PIDFD };
+        // Without the pidfd, the pipe closing tells that the process is done
+        if(epoll_ctl(jobs->_epoll, EPOLL_CTL_ADD, job->_pidfd, &event) != 0) {
+            close(job->_pidfd);
+            job->_pidfd = -1;
+        }
+    }
+    return cpid;
+#else
+    (void)jobs;
+    (void)index;
+    return _nocc_cmd_spawn(cmd, NULL, -1, -1, true);
+#endif // __linux__
+}
+
+// Reaps one process of the pool
+bool _nocc_jobs_reap(nocc_jobs* jobs, size_t* index_out, int* exit_code_out) {
+    size_t index = 0;
+    int exit_code = -1;
+#ifdef _WIN32
+    // NOTE: WaitForMultipleObjects caps out at MAXIMUM_WAIT_OBJECTS (64) handles, nocc_jobs_init keeps the pool within it.
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    size_t indices[MAXIMUM_WAIT_OBJECTS];
+    DWORD count = 0;
+    for(size_t i = 0; i < jobs->max_jobs && count < MAXIMUM_WAIT_OBJECTS; i++) {
+        if(jobs->slots[i].pid == NOCC_INVALID_PID) continue;
+        handles[count] = jobs->slots[i].pid;
+        indices[count] = i;
+        count++;
+    }
+
+    DWORD result = WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+    if(result == WAIT_FAILED || result >= WAIT_OBJECT_0 + count) {
+        nocc_error("Could not wait for child processes: %lu", GetLastError());
+        return false;
+    }
+
+    index = indices[result - WAIT_OBJECT_0];
+    DWORD code;
+    if(GetExitCodeProcess(jobs->slots[index].pid, &code)) exit_code = (int)code;
+    CloseHandle(jobs->slots[index].pid);
+#else
+#ifdef __linux__
+    if(jobs->_epoll >= 0) return _nocc_jobs_reap_epoll(jobs, index_out, exit_code_out);
+#endif // __linux__
+
+    // Only the processes of the pool are waited on, children the build script started itself are left alone.
+    // There is no portable way to block on a set of pids, so the slots are polled, backing off up to 10ms.
+    long delay_us = 50;
+    for(;;) {
+        if(_nocc_jobs_signal && !jobs->_cancelled) nocc_jobs_kill(jobs);
+
+        bool reaped = false;
+        for(index = 0; index < jobs->max_jobs; index++) {
+            pid_t cpid = jobs->slots[index].pid;
+            if(cpid == NOCC_INVALID_PID) continue;
+
+            int wstatus = 0;
+            pid_t result = waitpid(cpid, &wstatus, WNOHANG);
+            if(result == cpid && (WIFEXITED(wstatus) || WIFSIGNALED(wstatus))) {
+                exit_code = _nocc_cmd_exit_code(wstatus);
+                reaped = true;
+            } else if(result < 0 && errno != EINTR) {
+                // e.g. ECHILD when SIGCHLD is ignored, the process is gone and its exit code with it
+                nocc_error("Could not wait for child process %d: %s", (int)cpid, strerror(errno));
+                exit_code = -1;
+                reaped = true;
+            }
+            if(reaped) break;
+        }
+        if(reaped) break;
+
+        // A signal cuts the sleep short, so cancelling does not wait for it
+        struct timespec delay = { .tv_sec = 0, .tv_nsec = delay_us * 1000 };
+        nanosleep(&delay, NULL);
+        if(delay_us < 10000) delay_us *= 2;
+    }
+#endif // _WIN32
+
+    jobs->slots[index].pid = NOCC_INVALID_PID;
+    *index_out = index;
+    *exit_code_out = exit_code;
+    return true;
+}
+
+// Moves a cached compile to its next phase. Returns true if the job is running again.
+bool _nocc_jobs_advance_cache(nocc_jobs* jobs, size_t index, int* exit_code) {
+    nocc_job* job = &jobs->slots[index];
+    _nocc_cache_job* cache = job->_cache;
+    if(cache->phase == _NOCC_CACHE_PREPROCESS) {
+        // A failing preprocessor falls through to the compiler, so its diagnostics get printed
+        if(*exit_code == 0 && _nocc_cache_compute_key(cache) && _nocc_cache_lookup(cache)) {
+            *exit_code = 0;
+            return false;
+        }
+
+        cache->phase = _NOCC_CACHE_COMPILE;
+        // A link restored by an earlier hit must not be compiled into, that would rewrite the cache entry
+        if(_nocc_cache.hardlink) remove(cache->output);
+        // The compiler repeats whatever the preprocessor had to say
+        for(size_t stream = 0; stream < 2; stream++) {
+            if(job->_printed[stream] == NULL) continue;
+            nocc_str_free(job->_printed[stream]);
+            job->_printed[stream] = NULL;
+        }
+        job->pid = _nocc_jobs_spawn(jobs, index, cache->cmd);
+        if(job->pid != NOCC_INVALID_PID) return true;
+        *exit_code = -1;
+        return false;
+    }
+
+    if(*exit_code == 0) _nocc_cache_store(cache);
+    return false;
+}
+
+/**
+ * @brief Waits for any of the running jobs to finish.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * @param {nocc_job*} finished -- (optional) receives the finished job, including its exit code and user data
+ * 
+ * @return {bool} false if there was nothing to wait for.
+*/
+bool nocc_jobs_wait_any(nocc_jobs* jobs, nocc_job* finished) {
+    if(jobs->running == 0) return false;
+    // Shows what is running while waiting for it
+    nocc_log_flush();
+
+    size_t index;
+    int exit_code;
+    for(;;) {
+        if(!_nocc_jobs_reap(jobs, &index, &exit_code)) return false;
+
+        nocc_job* job = &jobs->slots[index];
+        if(job->_cache == NULL || jobs->_cancelled || !_nocc_jobs_advance_cache(jobs, index, &exit_code)) break;
+    }
+
+    nocc_job* job = &jobs->slots[index];
+    bool killed = jobs->_cancelled && exit_code != 0;
+    for(size_t stream = 0; stream < 2; stream++) {
+        nocc_string printed = job->_printed[stream];
+        if(printed == NULL) continue;
+        // Whatever a killed job had to say is noise
+        if(nocc_da_size(printed) > 0 && !killed) {
+            FILE* file = stream == 0 ? stdout : stderr;
+            nocc_log_flush();
+            fwrite(printed, 1, nocc_da_size(printed), file);
+            fflush(file);
+        }
+        nocc_str_free(printed);
+        job->_printed[stream] = NULL;
+    }
+    if(job->_cache) {
+        _nocc_cache_job_free(job->_cache);
+        job->_cache = NULL;
+    }
+    for(size_t i = 0; i < 2; i++) {
+        if(job->_outputs[i] == NULL) continue;
+        if(killed) remove(job->_outputs[i]);
+        nocc_stat_cache_invalidate(job->_outputs[i]);
+        free(job->_outputs[i]);
+        job->_outputs[i] = NULL;
+    }
+    job->exit_code = exit_code;
+    job->end = nocc_now_ns();
+    if(nocc_tracing() && job->_trace_name != SIZE_MAX) {
+        _nocc_trace_event_push("command", job->_trace_name, job->_trace_args, index + 1, job->start, job->end);
+    }
+    job->_trace_name = job->_trace_args = SIZE_MAX;
+    if(exit_code != 0) jobs->failed++;
+    if(finished) *finished = *job;
+
+    job->pid = NOCC_INVALID_PID;
+    job->user_data = NULL;
+    jobs->weight -= job->weight;
+    jobs->running--;
+    if(jobs->running == 0) jobs->_cancelled = false;
+#ifndef _WIN32
+    _nocc_jobs_in_flight--;
+    if(_nocc_jobs_in_flight == 0 && _nocc_jobs_signal) {
+        // Everything is cleaned up, go down the way the signal asked for
+        signal(_nocc_jobs_signal, SIG_DFL);
+        raise(_nocc_jobs_signal);
+    }
+#endif // _WIN32
+    return true;
+}
+
+/**
+ * @brief Waits for every running job to finish.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * 
+ * @return {bool} true if none of the jobs submitted to the pool failed.
+*/
+bool nocc_jobs_wait_all(nocc_jobs* jobs) {
+    while(nocc_jobs_wait_any(jobs, NULL));
+    return jobs->failed == 0;
+}
+
+/**
+ * @brief Kills every running job, waits for them and removes their half written outputs.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * 
+ * @return {void}
+*/
+void nocc_jobs_cancel(nocc_jobs* jobs) {
+    nocc_jobs_kill(jobs);
+    while(nocc_jobs_wait_any(jobs, NULL));
+}
+
+typedef enum {
+    _NOCC_JOBS_STARTED,
+    _NOCC_JOBS_BUSY,        // the pool is full or the machine is busy, nothing was started
+    _NOCC_JOBS_FAILED
+} _nocc_jobs_start_result;
+
+// nocc_jobs_submit with a name for the trace and a weight, see nocc_jobs_submit_weighted
+bool _nocc_jobs_submit(nocc_jobs* jobs, nocc_darray(const char*) cmd, void* user_data, const char* name, size_t weight);
+_nocc_jobs_start_result _nocc_jobs_start(nocc_jobs* jobs, nocc_darray(const char*) cmd, void* user_data, const char* name, size_t weight);
+
+/**
+ * @brief Starts the command in the pool. If the pool is full, this blocks until a slot frees up.
+ * The command can be freed as soon as this returns.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * @param {nocc_darray(const char*)} cmd -- the command and its arguments
+ * @param {void*} user_data -- handed back through nocc_jobs_wait_any
+ * 
+ * @return {bool} false if the process could not be started.
+*/
+bool nocc_jobs_submit(nocc_jobs* jobs, nocc_darray(const char*) cmd, void* user_data) {
+    _nocc_compdb_record(cmd);
+    return _nocc_jobs_submit(jobs, cmd, user_data, NULL, 1);
+}
+
+/**
+ * @brief Same as nocc_jobs_submit, for a job that counts as `weight` slots, e.g. a link that takes the memory of several compiles.
+ * A job heavier than the pool runs on its own.
+ * 
+ * @param {nocc_jobs*} jobs -- the pool
+ * @param {nocc_darray(const char*)} cmd -- the command and its arguments
+ * @param {void*} user_data -- handed back through nocc_jobs_wait_any
+ * @param {size_t} weight -- the amount of slots the job takes up
+ * 
+ * @return {bool} false if the process could not be started.
+*/
+bool nocc_jobs_submit_weighted(nocc_jobs* jobs, nocc_darray(const char*) cmd, void* user_data, size_t weight) {
+    _nocc_compdb_record(cmd);
+    return _nocc_jobs_submit(jobs, cmd, user_data, NULL, weight);
+}
+
+// `name` is what the command shows up as in the trace, the output of the command if NULL
+bool _nocc_jobs_submit(nocc_jobs* jobs, nocc_darray(const char*) cmd, void* user_data, const char* name, size_t weight) {
+    for(;;) {
+        _nocc_jobs_start_result result = _nocc_jobs_start(jobs, cmd, user_data, name, weight);
+        if(result != _NOCC_JOBS_BUSY) return result == _NOCC_JOBS_STARTED;
+        if(!nocc_jobs_wait_any(jobs, NULL)) return false;
+    }
+}
+
+// Starts the command if the pool and the machine have room for it. Never waits for a running job, so the caller gets
+// to see every job that finishes (nocc_graph_build keeps track of its targets through them).
+_nocc_jobs_start_result _nocc_jobs_start(nocc_jobs* jobs, nocc_darray(const char*) cmd, void* user_data, const char* name, size_t weight) {
+    nocc_darray(const char*) pch_cmd = _nocc_pch_apply(cmd);
+    if(pch_cmd) {
+        _nocc_jobs_start_result result = _nocc_jobs_start(jobs, pch_cmd, user_data, name ? name : _nocc_cmd_arg_value(cmd, "-o"), weight);
+        nocc_da_free(pch_cmd);
+        return result;
+    }
+
+    if(weight == 0) weight = 1;
+    if(!_nocc_jobs_can_start(jobs, weight)) return _NOCC_JOBS_BUSY;
+#ifndef _WIN32
+    if(_nocc_jobs_signal) return _NOCC_JOBS_FAILED;
+#endif // _WIN32
+
+    size_t index = 0;
+    for(; index < jobs->max_jobs; index++) {
+        if(jobs->slots[index].pid == NOCC_INVALID_PID) break;
+    }
+
+    const char* output = _nocc_cmd_arg_value(cmd, "-o");
+    const char* depfile = _nocc_cmd_arg_value(cmd, "-MF");
+    if(nocc_tracing()) {
+        jobs->slots[index]._trace_name = _nocc_trace_string(name ? name : output ? output : cmd[0], NULL);
+        jobs->slots[index]._trace_args = _nocc_trace_string(NULL, cmd);
+    }
+
+    // With the cache on, compiles start out as the preprocessor, see _nocc_jobs_advance_cache
+    _nocc_cache_job* cache = NULL;
+    if(_nocc_cache_applies(cmd)) {
+        cache = _nocc_cache_job_create(cmd);
+        cmd = _nocc_cache_preprocess_cmd(cache);
+    }
+
+    int64_t start = nocc_now_ns();
+    pid cpid = _nocc_jobs_spawn(jobs, index, cmd);
+    if(cache) nocc_da_free(cmd);
+    if(cpid == NOCC_INVALID_PID) {
+        if(cache) _nocc_cache_job_free(cache);
+        jobs->failed++;
+        return _NOCC_JOBS_FAILED;
+    }
+
+    jobs->slots[index].pid = cpid;
+    jobs->slots[index].user_data = user_data;
+    jobs->slots[index].exit_code = 0;
+    jobs->slots[index].weight = weight;
+    jobs->weight += weight;
+#ifndef _WIN32
+    _nocc_jobs_in_flight++;
+#endif // _WIN32
+    jobs->slots[index].start = start;
+    jobs->slots[index]._cache = cache;
+    jobs->slots[index]._outputs[0] = output ? strdup(output) : NULL;
+    jobs->slots[index]._outputs[1] = depfile ? strdup(depfile) : NULL;
+    jobs->running++;
+    return _NOCC_JOBS_STARTED;
+}
+
+// Runs a cached compile for nocc_cmd_execute, through a pool of one
+bool _nocc_cache_execute(nocc_darray(const char*) cmd) {
+    nocc_jobs jobs;
+    nocc_jobs_init(&jobs, 1);
+    bool status = nocc_jobs_submit(&jobs, cmd, NULL) && nocc_jobs_wait_all(&jobs);
+    nocc_jobs_free(&jobs);
+    return status;
+}
+
+// Jobs End ===============================================================
+
+// Targets Begin ==========================================================
+
+typedef enum {
+    NOCC_TS_WAITING = 0,
+    NOCC_TS_RUNNING,
+    NOCC_TS_UP_TO_DATE,
+    NOCC_TS_REBUILT,
+    NOCC_TS_FAILED,
+    NOCC_TS_SKIPPED         // a dependency failed
+} _nocc_target_state;
+
+/**
+ * @brief What a graph build does once a command fails.
+ * NOCC_FAIL_FAST kills the commands still running (removing their half written outputs) and starts nothing new.
+ * NOCC_KEEP_GOING still builds every target whose dependencies did not fail, like make -k.
+ * Either way the build reports the failure.
+*/
+typedef enum {
+    NOCC_FAIL_FAST = 0,
+    NOCC_KEEP_GOING
+} nocc_failure_policy;
+
+/**
+ * @brief A node of the build graph. The strings are not owned by the target and have to outlive the build,
+ * the arrays are owned by it and freed with the graph.
+*/
+typedef struct nocc_target {
+    const char* name;
+    nocc_darray(const char*) inputs;
+    nocc_darray(const char*) outputs;
+    nocc_darray(const char*) cmd;
+    nocc_darray(struct nocc_target*) deps;
+    char* depfile;
+    size_t weight;          // the amount of job slots the command takes up, 0 is 1. See nocc_jobs_submit_weighted.
+
+    // internal
+    nocc_darray(struct nocc_target*) _dependents;
+    size_t _pending;
+    _nocc_target_state _state;
+    nocc_db_snapshot _snapshot;     // the inputs as they were when the command started
+    bool _optional;                 // failing does not fail the build, the dependents run anyway (a precompiled header)
+} nocc_target;
+
+typedef struct {
+    nocc_darray(nocc_target*) targets;
+    nocc_failure_policy on_failure;
+} nocc_graph;
+
+/**
+ * @brief Adds the files to the inputs/outputs of the target, or the arguments to its command.
+ * 
+ * @param {nocc_target*} t -- The target
+ * @param {...} ... -- The strings to add
+ * 
+ * @return {void}
+*/
+#define nocc_target_inputs(t, ...)      nocc_cmd_add((t)->inputs, __VA_ARGS__)
+#define nocc_target_outputs(t, ...)     nocc_cmd_add((t)->outputs, __VA_ARGS__)
+#define nocc_target_cmd(t, ...)         nocc_cmd_add((t)->cmd, __VA_ARGS__)
+
+void nocc_graph_init(nocc_graph* graph) {
+    graph->targets = nocc_da_create(nocc_target*);
+    graph->on_failure = NOCC_FAIL_FAST;
+}
+
+/**
+ * @brief Frees the graph and every target in it.
+ * 
+ * @param {nocc_graph*} graph -- The graph
+ * 
+ * @return {void}
+*/
+void nocc_graph_free(nocc_graph* graph) {
+    for(size_t i = 0; i < nocc_da_size(graph->targets); i++) {
+        nocc_target* target = graph->targets[i];
+        nocc_da_free(target->inputs);
+        nocc_da_free(target->outputs);
+        nocc_da_free(target->cmd);
+        nocc_da_free(target->deps);
+        nocc_da_free(target->_dependents);
+        nocc_db_snapshot_free(&target->_snapshot);
+        free(target->depfile);
+        free(target);
+    }
+    nocc_da_free(graph->targets);
+    graph->targets = NULL;
+}
+
+/**
+ * @brief Creates a new target in the graph. A target without a command only groups its dependencies.
+ * 
+ * @param {nocc_graph*} graph -- The graph
+ * @param {const char*} name -- The name of the target, used for logging.
+ * 
+ * @return {nocc_target*} the target, owned by the graph.
+*/
+nocc_target* nocc_graph_add(nocc_graph* graph, const char* name) {
+    nocc_target* target = calloc(1, sizeof(nocc_target));
+    target->name = name;
+    target->inputs = nocc_da_create(const char*);
+    target->outputs = nocc_da_create(const char*);
+    target->cmd = nocc_da_create(const char*);
+    target->deps = nocc_da_create(nocc_target*);
+    target->_dependents = nocc_da_create(nocc_target*);
+    nocc_da_push(graph->targets, target);
+    return target;
+}
+
+/**
+ * @brief The target is not started until `dep` finished. The outputs of `dep` become inputs of the target.
+ * 
+ * @param {nocc_target*} target -- The target
+ * @param {nocc_target*} dep -- The target it depends on
+ * 
+ * @return {void}
+*/
+void nocc_target_depends_on(nocc_target* target, nocc_target* dep) {
+    nocc_da_push(target->deps, dep);
+}
+
+/**
+ * @brief Tracks the headers of a compile target. Adds -MMD -MF to the command and checks the headers
+ * listed in the depfile on the next build.
+ * 
+ * @param {nocc_target*} target -- The target
+ * @param {const char*} depfile -- where the depfile goes. NULL means the first output with '.d' appended.
+ * 
+ * @return {void}
+*/
+void nocc_target_depfile(nocc_target* target, const char* depfile) {
+    nocc_assert(depfile || nocc_da_size(target->outputs) > 0, "%s has no output to derive the depfile from", target->name);
+
+    nocc_string path = nocc_str_create();
+    if(depfile) {
+        nocc_str_push_cstr(path, depfile);
+    } else {
+        nocc_str_push_cstr(path, target->outputs[0]);
+        nocc_str_push_cstr(path, ".d");
+    }
+    nocc_str_push_null(path);
+
+    free(target->depfile);
+    target->depfile = strdup(path);
+    nocc_str_free(path);
+
+    nocc_cmd_add_depfile(target->cmd, target->depfile);
+}
+
+// The inputs of the target plus the outputs of its dependencies
+nocc_darray(const char*) _nocc_target_collect_inputs(nocc_target* target) {
+    nocc_darray(const char*) inputs = nocc_da_create(const char*);
+    for(size_t i = 0; i < nocc_da_size(target->inputs); i++) {
+        nocc_da_push(inputs, target->inputs[i]);
+    }
+
+    for(size_t i = 0; i < nocc_da_size(target->deps); i++) {
+        nocc_target* dep = target->deps[i];
+        for(size_t j = 0; j < nocc_da_size(dep->outputs); j++) {
+            nocc_da_push(inputs, dep->outputs[j]);
+        }
+    }
+    // Every input is stat'ed and hashed once, even if it is named twice
+    _nocc_paths_unique(inputs, 0);
+    return inputs;
+}
+
+bool _nocc_target_is_stale(nocc_target* target) {
+    if(nocc_da_size(target->cmd) == 0) return false;
+    if(nocc_da_size(target->outputs) == 0) return true;
+
+    // A dependency without outputs has nothing to compare against, running it means this has to run too
+    for(size_t i = 0; i < nocc_da_size(target->deps); i++) {
+        nocc_target* dep = target->deps[i];
+        if(dep->_state == NOCC_TS_REBUILT && nocc_da_size(dep->outputs) == 0) return true;
+    }
+
+    nocc_darray(const char*) inputs = _nocc_target_collect_inputs(target);
+
+    bool stale = false;
+    for(size_t i = 0; i < nocc_da_size(target->outputs) && !stale; i++) {
+        if(_nocc_db.path)        stale = nocc_db_should_rebuild(target->outputs[i], target->cmd, inputs, nocc_da_size(inputs));
+        else if(target->depfile) stale = nocc_should_recompile_depfile(inputs, nocc_da_size(inputs), target->outputs[i], target->depfile);
+        else                     stale = nocc_should_recompile(inputs, nocc_da_size(inputs), target->outputs[i]);
+    }
+
+    nocc_da_free(inputs);
+    return stale;
+}
+
+// Takes the signatures of what the command is about to read: the inputs, and the headers it read last time
+void _nocc_target_snapshot(nocc_target* target) {
+    nocc_db_snapshot_free(&target->_snapshot);
+    if(_nocc_db.path == NULL) return;
+
+    nocc_darray(const char*) inputs = _nocc_target_collect_inputs(target);
+    for(size_t i = 0; i < nocc_da_size(target->outputs); i++) {
+        _nocc_db_view view;
+        if(!_nocc_db_lookup(_nocc_db_key(target->outputs[i]), &view)) continue;
+        for(size_t j = 0; j < view.input_count; j++) {
+            nocc_da_push(inputs, view.strings + view.inputs[j].path);
+        }
+    }
+    _nocc_paths_unique(inputs, 0);
+    nocc_db_snapshot_take(&target->_snapshot, inputs, nocc_da_size(inputs));
+    nocc_da_free(inputs);
+}
+
+// Remembers what the outputs were built from and how, in the build database
+void _nocc_target_record(nocc_target* target, int64_t duration) {
+    if(_nocc_db.path == NULL) return;
+
+    nocc_darray(const char*) inputs = _nocc_target_collect_inputs(target);
+
+    char* data = NULL;
+    size_t size = 0;
+    if(target->depfile && (data = nocc_read_entire_file(target->depfile, &size)) != NULL) {
+        nocc_depfile_parse(data, size, &inputs);
+    }
+
+    for(size_t i = 0; i < nocc_da_size(target->outputs); i++) {
+        nocc_db_record(inputs, nocc_da_size(inputs), target->outputs[i], target->cmd, duration, &target->_snapshot);
+    }
+
+    free(data);
+    nocc_da_free(inputs);
+}
+
+void _nocc_pch_finished(nocc_target* target);
+
+void _nocc_target_finish(nocc_target* target, _nocc_target_state state, nocc_darray(nocc_target*)* ready) {
+    target->_state = state;
+    nocc_db_snapshot_free(&target->_snapshot);
+    if(state == NOCC_TS_REBUILT || state == NOCC_TS_FAILED) {
+        for(size_t i = 0; i < nocc_da_size(target->outputs); i++) nocc_stat_cache_invalidate(target->outputs[i]);
+        if(target->depfile) nocc_stat_cache_invalidate(target->depfile);
+    }
+    _nocc_pch_finished(target);
+    if((state == NOCC_TS_FAILED && !target->_optional) || state == NOCC_TS_SKIPPED) {
+        for(size_t i = 0; i < nocc_da_size(target->_dependents); i++) {
+            nocc_target* dependent = target->_dependents[i];
+            if(dependent->_state == NOCC_TS_WAITING) _nocc_target_finish(dependent, NOCC_TS_SKIPPED, ready);
+        }
+        return;
+    }
+
+    for(size_t i = 0; i < nocc_da_size(target->_dependents); i++) {
+        nocc_target* dependent = target->_dependents[i];
+        if(--dependent->_pending == 0 && dependent->_state == NOCC_TS_WAITING) nocc_da_push(*ready, dependent);
+    }
+}
+
+int _nocc_compare_paths(const void* a, const void* b) {
+    return strcmp(_nocc_path_skip_dot(*(const char**)a), _nocc_path_skip_dot(*(const char**)b));
+}
+
+bool _nocc_paths_contain(nocc_darray(const char*) sorted, const char* path) {
+    return sorted && bsearch(&path, sorted, nocc_da_size(sorted), sizeof(const char*), _nocc_compare_paths) != NULL;
+}
+
+// Whether any of the changed files is an input, output or header of the target, or a dependency was rebuilt
+bool _nocc_target_is_affected(nocc_target* target, nocc_darray(const char*) changed) {
+    for(size_t i = 0; i < nocc_da_size(target->deps); i++) {
+        if(target->deps[i]->_state == NOCC_TS_REBUILT) return true;
+    }
+    for(size_t i = 0; i < nocc_da_size(target->inputs); i++) {
+        if(_nocc_paths_contain(changed, target->inputs[i])) return true;
+    }
+    for(size_t i = 0; i < nocc_da_size(target->outputs); i++) {
+        if(_nocc_paths_contain(changed, target->outputs[i])) return true;
+    }
+    if(target->depfile == NULL) return false;
+
+    size_t size = 0;
+    char* data = nocc_read_entire_file(target->depfile, &size);
+    if(data == NULL) return true;
+
+    nocc_darray(const char*) prereqs = nocc_da_create(const char*);
+    nocc_depfile_parse(data, size, &prereqs);
+    bool affected = false;
+    for(size_t i = 0; i < nocc_da_size(prereqs) && !affected; i++) {
+        affected = _nocc_paths_contain(changed, prereqs[i]);
+    }
+
+    nocc_da_free(prereqs);
+    free(data);
+    return affected;
+}
+
+bool _nocc_graph_build(nocc_graph* graph, nocc_jobs* jobs, nocc_darray(const char*) changed);
+void _nocc_pch_invalidate(void);
+bool _nocc_pch_outdates(nocc_target* target);
+nocc_target* _nocc_pch_target(nocc_darray(const char*) cmd);
+
+/**
+ * @brief Builds every stale target of the graph. Targets start as soon as all their dependencies
+ * finished, so independent targets run at the same time (up to the size of the pool).
+ * 
+ * @param {nocc_graph*} graph -- The graph
+ * @param {nocc_jobs*} jobs -- The pool to run the commands in
+ * 
+ * @return {bool} false if a command failed or the graph has a cycle.
+*/
+bool nocc_graph_build(nocc_graph* graph, nocc_jobs* jobs) {
+    return _nocc_graph_build(graph, jobs, NULL);
+}
+
+/**
+ * @brief Same as nocc_graph_build, but only the targets the changed files affect (as inputs, outputs, headers from
+ * their depfile, or through a rebuilt dependency) are checked, the rest is assumed to be up to date without touching the disk.
+ * Meant for rebuilding after a nocc_watch_wait.
+ * 
+ * @param {nocc_graph*} graph -- The graph
+ * @param {nocc_jobs*} jobs -- The pool to run the commands in
+ * @param {const char**} changed -- the files that changed
+ * @param {size_t} changed_size -- the amount of changed files
+ * 
+ * @return {bool} false if a command failed or the graph has a cycle.
+*/
+bool nocc_graph_build_changed(nocc_graph* graph, nocc_jobs* jobs, const char** changed, size_t changed_size) {
+    nocc_darray(const char*) sorted = nocc_da_reserve(const char*, changed_size + 1);
+    if(changed_size > 0) nocc_da_pushn(sorted, changed_size, (void*)changed);
+    qsort(sorted, changed_size, sizeof(const char*), _nocc_compare_paths);
+
+    bool status = _nocc_graph_build(graph, jobs, sorted);
+    nocc_da_free(sorted);
+    return status;
+}
+
+bool _nocc_graph_build(nocc_graph* graph, nocc_jobs* jobs, nocc_darray(const char*) changed) {
+    nocc_stat_cache_begin();
+    _nocc_pch_invalidate();
+    size_t graph_count = nocc_da_size(graph->targets);
+
+    // The precompiled headers the compiles use join the build as targets of their own, the compiles wait for them
+    nocc_darray(nocc_target*) targets = nocc_da_reserve(nocc_target*, graph_count + 1);
+    nocc_darray(nocc_target*) pch = nocc_da_reserve(nocc_target*, graph_count + 1);
+    if(graph_count > 0) nocc_da_pushn(targets, graph_count, graph->targets);
+    for(size_t i = 0; i < graph_count; i++) {
+        nocc_target* header = _nocc_pch_target(graph->targets[i]->cmd);
+        nocc_da_push(pch, header);
+        if(header == NULL) continue;
+
+        bool listed = false;
+        for(size_t j = graph_count; j < nocc_da_size(targets) && !listed; j++) listed = targets[j] == header;
+        if(!listed) nocc_da_push(targets, header);
+    }
+    size_t count = nocc_da_size(targets);
+
+    // Every directory the outputs go into is created once, before any command runs
+    nocc_darray(const char*) outputs = nocc_da_reserve(const char*, count + 1);
+    for(size_t i = 0; i < count; i++) {
+        nocc_target* target = targets[i];
+        if(nocc_da_size(target->outputs) > 0) nocc_da_pushn(outputs, nocc_da_size(target->outputs), (void*)target->outputs);
+        if(target->depfile) nocc_da_push(outputs, (const char*)target->depfile);
+    }
+    bool created = nocc_mkdir_parents(outputs, nocc_da_size(outputs));
+    nocc_da_free(outputs);
+    if(!created) {
+        nocc_da_free(pch);
+        nocc_da_free(targets);
+        nocc_stat_cache_end();
+        return false;
+    }
+    nocc_darray(nocc_target*) ready = nocc_da_reserve(nocc_target*, count + 1);
+
+    for(size_t i = 0; i < count; i++) {
+        nocc_target* target = targets[i];
+        // Every target goes in, whether it turns out up to date, fails, or is never reached. The database describes the whole project.
+        if(i < graph_count) _nocc_compdb_record(target->cmd);
+        target->_state = NOCC_TS_WAITING;
+        target->_pending = nocc_da_size(target->deps);
+        nocc_da_free(target->_dependents);
+        target->_dependents = nocc_da_create(nocc_target*);
+    }
+    for(size_t i = 0; i < count; i++) {
+        nocc_target* target = targets[i];
+        for(size_t j = 0; j < nocc_da_size(target->deps); j++) {
+            nocc_da_push(target->deps[j]->_dependents, target);
+        }
+        if(i < graph_count && pch[i]) {
+            nocc_da_push(pch[i]->_dependents, target);
+            target->_pending++;
+        }
+    }
+    // The headers go first, every compile using them waits on them
+    for(size_t i = graph_count; i < count; i++) nocc_da_push(ready, targets[i]);
+    for(size_t i = 0; i < graph_count; i++) {
+        if(targets[i]->_pending == 0) nocc_da_push(ready, targets[i]);
+    }
+
+    bool status = true;
+    bool stop = false;
+    size_t head = 0;
+    while(!stop) {
+        bool submitted = false;
+        while(head < nocc_da_size(ready) && _nocc_jobs_can_start(jobs, ready[head]->weight ? ready[head]->weight : 1)) {
+            nocc_target* target = ready[head++];
+            // A dependency failed after the target became ready
+            if(target->_state != NOCC_TS_WAITING) continue;
+
+            int64_t trace_start = nocc_tracing() ? nocc_now_ns() : 0;
+            bool stale = _nocc_pch_outdates(target) || ((changed == NULL || _nocc_target_is_affected(target, changed)) && _nocc_target_is_stale(target));
+            nocc_trace_span("stale", target->name, trace_start);
+            if(!stale) {
+                _nocc_target_finish(target, NOCC_TS_UP_TO_DATE, &ready);
+                continue;
+            }
+
+            target->_state = NOCC_TS_RUNNING;
+            _nocc_target_snapshot(target);
+            _nocc_jobs_start_result started = _nocc_jobs_start(jobs, target->cmd, target, target->name, target->weight);
+            if(started == _NOCC_JOBS_BUSY) {
+                // The machine got busy while the target was checked, it is tried again once a job finished
+                target->_state = NOCC_TS_WAITING;
+                head--;
+                break;
+            }
+            nocc_info("Building %s", target->name);
+            if(started == _NOCC_JOBS_FAILED) {
+                _nocc_target_finish(target, NOCC_TS_FAILED, &ready);
+                if(target->_optional) continue;
+                nocc_error("Failed to start %s", target->name);
+                status = false;
+                stop = graph->on_failure == NOCC_FAIL_FAST;
+                if(stop) break;
+                continue;
+            }
+            submitted = true;
+        }
+
+        if(stop) break;
+        if(!submitted && jobs->running == 0) break;
+
+        nocc_job finished;
+        if(!nocc_jobs_wait_any(jobs, &finished)) break;
+        nocc_target* target = finished.user_data;
+        if(target == NULL) continue;
+
+        if(finished.exit_code != 0) {
+            _nocc_target_finish(target, NOCC_TS_FAILED, &ready);
+            if(target->_optional) continue;
+            nocc_error("%s failed with exit code %d", target->name, finished.exit_code);
+            status = false;
+            stop = graph->on_failure == NOCC_FAIL_FAST;
+            continue;
+        }
+        _nocc_target_record(target, finished.end - finished.start);
+        _nocc_target_finish(target, NOCC_TS_REBUILT, &ready);
+    }
+
+    // Whatever is still running has to be reaped before the graph can be touched again. Failing fast, it is killed first.
+    if(stop) nocc_jobs_kill(jobs);
+    nocc_job finished;
+    while(nocc_jobs_wait_any(jobs, &finished)) {
+        nocc_target* target = finished.user_data;
+        if(target == NULL) continue;
+        if(finished.exit_code == 0) _nocc_target_record(target, finished.end - finished.start);
+        _nocc_target_finish(target, finished.exit_code == 0 ? NOCC_TS_REBUILT : NOCC_TS_FAILED, &ready);
+    }
+
+    size_t skipped = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(targets[i]->_state == NOCC_TS_SKIPPED) skipped++;
+    }
+    if(skipped > 0) nocc_warn("%zu targets were not built because a dependency failed", skipped);
+
+    if(status) {
+        for(size_t i = 0; i < count; i++) {
+            if(targets[i]->_state == NOCC_TS_WAITING) {
+                nocc_error("%s is part of a dependency cycle", targets[i]->name);
+                status = false;
+                break;
+            }
+        }
+    }
+
+    nocc_db_save();
+    nocc_compdb_write();
+    nocc_da_free(ready);
+    nocc_da_free(pch);
+    nocc_da_free(targets);
+    nocc_stat_cache_end();
+    return status;
+}
+
+// Targets End ============================================================
+
+// Unity Begin ============================================================
+
+typedef struct {
+    char* path;             // absolute, unity files live in another directory than the sources
+    uint64_t size;
+    size_t group;           // SIZE_MAX until it is assigned
+} _nocc_unity_source;
+
+int _nocc_unity_compare_paths(const void* a, const void* b) {
+    return strcmp(((const _nocc_unity_source*)a)->path, ((const _nocc_unity_source*)b)->path);
+}
+
+// Biggest first, the path keeps the order the same from run to run
+int _nocc_unity_compare_sizes(const void* a, const void* b) {
+    const _nocc_unity_source* x = *(const _nocc_unity_source**)a;
+    const _nocc_unity_source* y = *(const _nocc_unity_source**)b;
+    if(x->size != y->size) return x->size < y->size ? 1 : -1;
+    return strcmp(x->path, y->path);
+}
+
+char* _nocc_unity_absolute_path(const char* path) {
+    if(path[0] == '/' || path[0] == '\\' || (path[0] != '\0' && path[1] == ':')) return strdup(path);
+
+    char cwd[4096] = "";
+#ifdef _WIN32
+    _getcwd(cwd, sizeof(cwd));
+#else
+    if(getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+#endif // _WIN32
+
+    nocc_string absolute = nocc_str_create();
+    nocc_str_push_cstr(absolute, cwd);
+    nocc_str_push_char(absolute, '/');
+    nocc_str_push_cstr(absolute, _nocc_path_skip_dot(path));
+    nocc_str_push_null(absolute);
+    char* result = strdup(absolute);
+    nocc_str_free(absolute);
+    return result;
+}
+
+// <dir>/unity_<group>.c
+nocc_string _nocc_unity_file(const char* dir, size_t group) {
+    char name[32];
+    snprintf(name, sizeof(name), "/unity_%zu.c", group);
+
+    nocc_string path = nocc_str_create();
+    nocc_str_push_cstr(path, dir);
+    nocc_str_push_cstr(path, name);
+    nocc_str_push_null(path);
+    return path;
+}
+
+// Puts every source without a group into the lightest group
+void _nocc_unity_assign(_nocc_unity_source* sources, size_t count, uint64_t* totals, size_t groups) {
+    nocc_darray(_nocc_unity_source*) pending = nocc_da_reserve(_nocc_unity_source*, count + 1);
+    for(size_t i = 0; i < count; i++) {
+        if(sources[i].group == SIZE_MAX) nocc_da_push(pending, &sources[i]);
+    }
+    qsort(pending, nocc_da_size(pending), sizeof(_nocc_unity_source*), _nocc_unity_compare_sizes);
+
+    for(size_t i = 0; i < nocc_da_size(pending); i++) {
+        size_t lightest = 0;
+        for(size_t g = 1; g < groups; g++) {
+            if(totals[g] < totals[lightest]) lightest = g;
+        }
+        pending[i]->group = lightest;
+        totals[lightest] += pending[i]->size;
+    }
+    nocc_da_free(pending);
+}
+
+/**
+ * @brief Batches the sources into `groups` generated unity files (<dir>/unity_<k>.c) that #include them, so
+ * headers shared by the sources get parsed once per group instead of once per source.
+ * Groups are balanced by file size. A source stays in the group the existing unity files put it in, new sources
+ * go to the lightest group, and a unity file is only rewritten when its list changes. Editing a source therefore
+ * rebuilds one group. Everything is redistributed when the group count changes or the groups drift too far apart.
+ * 
+ * @param {const char**} sources -- e.g. the files from nocc_read_dir
+ * @param {size_t} count -- the amount of sources
+ * @param {const char**} exclude -- sources that do not work in a unity file (clashing statics, macros that leak), can be NULL
+ * @param {size_t} exclude_count -- the amount of excluded sources
+ * @param {size_t} groups -- the amount of unity files, 0 means nocc_nprocs()
+ * @param {const char*} dir -- where the unity files are written, it has to exist
+ * @param {nocc_darray(char*)*} files_out -- receives the excluded sources and the unity files, each is one translation unit. Free them.
+ * 
+ * @return {bool} false if a unity file could not be written.
+*/
+bool nocc_unity_generate(const char** sources, size_t count, const char** exclude, size_t exclude_count, size_t groups, const char* dir, nocc_darray(char*)* files_out) {
+    if(groups == 0) groups = nocc_nprocs();
+
+    nocc_darray(_nocc_unity_source) batched = nocc_da_reserve(_nocc_unity_source, count + 1);
+    for(size_t i = 0; i < count; i++) {
+        bool excluded = false;
+        for(size_t j = 0; j < exclude_count && !excluded; j++) {
+            excluded = strcmp(_nocc_path_skip_dot(sources[i]), _nocc_path_skip_dot(exclude[j])) == 0;
+        }
+        if(excluded) {
+            nocc_da_push(*files_out, strdup(sources[i]));
+            continue;
+        }
+
+        nocc_file_info info;
+        nocc_get_file_info(sources[i], &info);
+        _nocc_unity_source source = { .path = _nocc_unity_absolute_path(sources[i]), .size = info.exists ? info.size : 0, .group = SIZE_MAX };
+        nocc_da_push(batched, source);
+    }
+    size_t batched_count = nocc_da_size(batched);
+    qsort(batched, batched_count, sizeof(_nocc_unity_source), _nocc_unity_compare_paths);
+    if(groups > batched_count) groups = batched_count;
+
+    // The groups of the last run, read back from the unity files
+    nocc_darray(char*) previous = nocc_da_reserve(char*, groups + 1);
+    bool reused = true;
+    for(size_t g = 0; g < groups; g++) {
+        nocc_string path = _nocc_unity_file(dir, g);
+        size_t size = 0;
+        char* data = nocc_read_entire_file(path, &size);
+        nocc_da_push(previous, data);
+        if(data == NULL) reused = false;
+        nocc_str_free(path);
+    }
+    // More files than groups means the group count went down, the ones left over would still get globbed up
+    for(size_t g = groups; ; g++) {
+        nocc_string extra = _nocc_unity_file(dir, g);
+        nocc_file_info info;
+        bool exists = nocc_get_file_info(extra, &info) && info.exists;
+        if(exists) {
+            remove(extra);
+            nocc_stat_cache_invalidate(extra);
+            reused = false;
+        }
+        nocc_str_free(extra);
+        if(!exists) break;
+    }
+
+    uint64_t* totals = calloc(groups, sizeof(uint64_t));
+    if(reused) {
+        for(size_t g = 0; g < groups; g++) {
+            const char* it = previous[g];
+            while((it = strstr(it, "#include \"")) != NULL) {
+                it += strlen("#include \"");
+                const char* end = strchr(it, '"');
+                if(end == NULL) break;
+
+                _nocc_unity_source key = { .path = calloc((size_t)(end - it) + 1, 1), .size = 0, .group = 0 };
+                memcpy(key.path, it, (size_t)(end - it));
+                _nocc_unity_source* source = bsearch(&key, batched, batched_count, sizeof(_nocc_unity_source), _nocc_unity_compare_paths);
+                if(source && source->group == SIZE_MAX) {
+                    source->group = g;
+                    totals[g] += source->size;
+                }
+                free(key.path);
+                it = end;
+            }
+        }
+        _nocc_unity_assign(batched, batched_count, totals, groups);
+
+        // Sticking to the old groups is worth a rebuild only up to a point
+        uint64_t total = 0, heaviest = 0;
+        for(size_t g = 0; g < groups; g++) {
+            total += totals[g];
+            if(totals[g] > heaviest) heaviest = totals[g];
+        }
+        if(groups > 1 && heaviest > 2 * (total / groups) + 1) reused = false;
+    }
+    if(!reused) {
+        nocc_trace("Redistributing %zu sources over %zu unity files", batched_count, groups);
+        memset(totals, 0, groups * sizeof(uint64_t));
+        for(size_t i = 0; i < batched_count; i++) batched[i].group = SIZE_MAX;
+        _nocc_unity_assign(batched, batched_count, totals, groups);
+    }
+
+    bool status = true;
+    nocc_darray(const char*) members = nocc_da_reserve(const char*, batched_count + 1);
+    for(size_t g = 0; g < groups; g++) {
+        nocc_string content = nocc_str_create();
+        nocc_str_push_cstr(content, "// Generated by nocc, do not edit\n");
+        nocc_da_clear(members);
+        for(size_t i = 0; i < batched_count; i++) {
+            if(batched[i].group != g) continue;
+            nocc_str_push_cstr(content, "#include \"");
+            nocc_str_push_cstr(content, batched[i].path);
+            nocc_str_push_cstr(content, "\"\n");
+            nocc_da_push(members, (const char*)batched[i].path);
+        }
+
+        nocc_string path = _nocc_unity_file(dir, g);
+        _nocc_compdb_unity_sources(path, members, nocc_da_size(members));
+        size_t size = nocc_da_size(content);
+        bool same = previous[g] && strlen(previous[g]) == size && memcmp(previous[g], content, size) == 0;
+        if(!same) {
+            nocc_string tmp = nocc_str_create();
+            nocc_str_push_cstr(tmp, path);
+            nocc_str_push_cstr(tmp, ".tmp");
+            nocc_str_push_null(tmp);
+
+            // A half written file would be read back as the groups of this run, only a complete one replaces the old
+            FILE* file = fopen(tmp, "wb");
+            bool written = file != NULL && fwrite(content, 1, size, file) == size;
+            if(file && fclose(file) != 0) written = false;
+            if(!written || !_nocc_rename_file(tmp, path)) {
+                nocc_error("Could not write %s: %s", path, strerror(errno));
+                remove(tmp);
+                status = false;
+            }
+            nocc_str_free(tmp);
+            nocc_stat_cache_invalidate(path);
+        }
+        nocc_da_push(*files_out, strdup(path));
+        nocc_str_free(path);
+        nocc_str_free(content);
+    }
+
+    nocc_da_free(members);
+    for(size_t g = 0; g < groups; g++) free(previous[g]);
+    nocc_da_free(previous);
+    for(size_t i = 0; i < batched_count; i++) free(batched[i].path);
+    nocc_da_free(batched);
+    free(totals);
+    return status;
+}
+
+// Unity End ==============================================================
+
+// Precompiled Header Begin ===============================================
+
+// One precompiled header per compiler, language and set of flags, the compiler refuses the header otherwise
+typedef struct {
+    uint64_t key;
+    bool checked;           // brought up to date during the current build
+    bool rebuilt;           // built during the current build, every compile using it is stale
+    bool ok;
+    nocc_target* target;    // builds the header, lives in _nocc_pch.graph
+    nocc_darray(const char*) flags;
+    nocc_darray(char*) strings;
+} _nocc_pch_config;
+
+typedef struct {
+    char* header;
+    char* dir;
+    nocc_graph graph;
+    nocc_darray(_nocc_pch_config*) configs;
+} _nocc_pch_t;
+
+static _nocc_pch_t _nocc_pch = {0};
+
+/**
+ * @brief Precompiles `header` and makes every compile command (-c of a C, C++, Objective-C or Objective-C++ source) include it first,
+ * through nocc_cmd_execute, nocc_jobs_submit and the graph. The header is built once per compiler and set of flags,
+ * and again only when it or one of its includes changed. A graph build runs it as a target the compiles using it
+ * depend on, so the pool keeps building everything else meanwhile. nocc_cmd_execute and nocc_jobs_submit build it
+ * before the first command that needs it.
+ * Clang gets -include-pch <dir>/<key>/<name>.pch, anything else (GCC) -include <dir>/<key>/<name> next to a .gch.
+ * The compiler is told apart by what `<compiler> --version` prints, not by its name (cc and gcc are Clang on macOS).
+ * The header is compiled as the language of the source, assembly and CUDA (.cu) sources go without it.
+ * A header that fails to build is skipped, the compiles still work without it.
+ * 
+ * @param {const char*} header -- the prefix header, e.g. "./src/pch.h". It should hold the heavy, rarely changing includes.
+ * @param {const char*} dir -- where the precompiled headers go, its parent has to exist
+ * 
+ * @return {void}
+*/
+void nocc_pch_enable(const char* header, const char* dir) {
+    if(_nocc_pch.header == NULL) {
+        nocc_graph_init(&_nocc_pch.graph);
+        _nocc_pch.configs = nocc_da_create(_nocc_pch_config*);
+    }
+    free(_nocc_pch.header);
+    free(_nocc_pch.dir);
+    _nocc_pch.header = _nocc_unity_absolute_path(header);
+    _nocc_pch.dir = strdup(dir);
+    nocc_mkdir_if_not_exists(dir);
+}
+
+const char* _nocc_pch_header(void) {
+    return _nocc_pch.header;
+}
+
+// Every header has to be checked again, e.g. at the start of a build
+void _nocc_pch_invalidate(void) {
+    if(_nocc_pch.configs == NULL) return;
+    for(size_t i = 0; i < nocc_da_size(_nocc_pch.configs); i++) {
+        _nocc_pch.configs[i]->checked = false;
+        _nocc_pch.configs[i]->rebuilt = false;
+    }
+}
+
+// Keeps a string alive for as long as the configuration
+const char* _nocc_pch_string(_nocc_pch_config* config, const char* str) {
+    char* copy = strdup(str);
+    nocc_da_push(config->strings, copy);
+    return copy;
+}
+
+// Whether the compiler is Clang, from what `<compiler> --version` prints into <dir>/version. The name decides if it does not run.
+bool _nocc_pch_is_clang(const char* compiler, const char* dir) {
+    nocc_string path = nocc_str_create();
+    nocc_str_push_cstr(path, dir);
+    nocc_str_push_cstr(path, "/version");
+    nocc_str_push_null(path);
+
+    nocc_darray(const char*) cmd = nocc_da_create(const char*);
+    nocc_cmd_add(cmd, compiler, "--version");
+    nocc_cmd_redirect redirect = { NULL, path, path };
+
+    bool clang;
+    char* data = NULL;
+    if(nocc_cmd_execute_redirect(cmd, &redirect) && (data = nocc_read_entire_file(path, NULL)) != NULL) {
+        // Apple's cc and gcc say "Apple clang version", GCC says "gcc (GCC)" or "cc (GCC)"
+        clang = strstr(data, "clang") != NULL;
+    } else {
+        const char* name = strrchr(compiler, '/');
+        clang = strstr(name ? name + 1 : compiler, "clang") != NULL;
+    }
+
+    remove(path);
+    free(data);
+    nocc_da_free(cmd);
+    nocc_str_free(path);
+    return clang;
+}
+
+_nocc_pch_config* _nocc_pch_config_create(nocc_darray(const char*) cmd, const char* source, uint64_t key, const char* language) {
+    _nocc_pch_config* config = calloc(1, sizeof(_nocc_pch_config));
+    config->key = key;
+    config->flags = nocc_da_create(const char*);
+    config->strings = nocc_da_create(char*);
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+    const char* name = strrchr(_nocc_pch.header, '/');
+    name = name ? name + 1 : _nocc_pch.header;
+
+    nocc_string dir = nocc_str_create();
+    nocc_str_push_cstr(dir, _nocc_pch.dir);
+    nocc_str_push_char(dir, '/');
+    nocc_str_push_cstr(dir, hex);
+    nocc_str_push_null(dir);
+    nocc_mkdir_if_not_exists(dir);
+
+    // <dir>/<key>/<name>, the header GCC is told to include. It finds the .gch next to it.
+    nocc_string stub = nocc_str_create();
+    nocc_str_push_cstr(stub, dir);
+    nocc_str_push_char(stub, '/');
+    nocc_str_push_cstr(stub, name);
+    nocc_str_push_null(stub);
+
+    bool clang = _nocc_pch_is_clang(cmd[0], dir);
+
+    nocc_string output = nocc_str_create();
+    nocc_da_pushn(output, nocc_da_size(stub) - 1, stub);
+    nocc_str_push_cstr(output, clang ? ".pch" : ".gch");
+    nocc_str_push_null(output);
+
+    config->target = nocc_graph_add(&_nocc_pch.graph, _nocc_pch_string(config, output));
+    nocc_target* target = config->target;
+    target->_optional = true;
+    nocc_da_push(target->inputs, _nocc_pch.header);
+    nocc_da_push(target->outputs, target->name);
+
+    const char* built = _nocc_pch.header;
+    if(!clang) {
+        // Without the .gch (e.g. it was built for other flags) GCC falls back to the real header through the stub.
+        // It is only written when missing or different, a newer stub would make the .gch stale on every run.
+        nocc_string include = nocc_str_create();
+        nocc_str_push_cstr(include, "#include \"");
+        nocc_str_push_cstr(include, _nocc_pch.header);
+        nocc_str_push_cstr(include, "\"\n");
+        nocc_str_push_null(include);
+
+        char* current = nocc_read_entire_file(stub, NULL);
+        if(current == NULL || strcmp(current, include) != 0) {
+            FILE* file = fopen(stub, "wb");
+            if(file) {
+                fputs(include, file);
+                fclose(file);
+            }
+            nocc_stat_cache_invalidate(stub);
+        }
+        free(current);
+        nocc_str_free(include);
+        built = _nocc_pch_string(config, stub);
+        // The stub is what the compiler reads, it has to be in the snapshot like the header or it shows up through the depfile
+        // only, freshly written and without a signature
+        nocc_da_push(target->inputs, built);
+    }
+
+    nocc_da_push(target->cmd, cmd[0]);
+    nocc_cmd_add(target->cmd, "-x", language);
+    for(size_t i = 1; i < nocc_da_size(cmd); i++) {
+        const char* arg = cmd[i];
+        if(arg == source || strcmp(arg, "-c") == 0) continue;
+        if(strcmp(arg, "-MMD") == 0 || strcmp(arg, "-MD") == 0 || strcmp(arg, "-MP") == 0) continue;
+        if(strcmp(arg, "-o") == 0 || strcmp(arg, "-MF") == 0 || strcmp(arg, "-MT") == 0 || strcmp(arg, "-MQ") == 0) { i++; continue; }
+        nocc_da_push(target->cmd, _nocc_pch_string(config, arg));
+    }
+    nocc_cmd_add(target->cmd, built, "-o", target->name);
+    nocc_target_depfile(target, NULL);
+
+    if(clang) {
+        nocc_cmd_add(config->flags, "-include-pch", target->name);
+    } else {
+        nocc_cmd_add(config->flags, "-Winvalid-pch", "-include", built);
+    }
+
+    nocc_str_free(output);
+    nocc_str_free(stub);
+    nocc_str_free(dir);
+    return config;
+}
+
+// What the header is compiled as (-x) for a source with the extension, NULL for the ones that do not get it:
+// assembly takes no headers, and CUDA goes through nvcc, which does not precompile headers the same way
+const char* _nocc_pch_language(const char* extension) {
+    if(strcmp(extension, "s") == 0 || strcmp(extension, "S") == 0 || strcmp(extension, "cu") == 0) return NULL;
+    if(strcmp(extension, "c") == 0)  return "c-header";
+    if(strcmp(extension, "m") == 0)  return "objective-c-header";
+    if(strcmp(extension, "mm") == 0 || strcmp(extension, "M") == 0) return "objective-c++-header";
+    return "c++-header";
+}
+
+// The precompiled header configuration for the command, created on first use but not built.
+// NULL if the command does not compile a C/C++ source or no header is enabled.
+_nocc_pch_config* _nocc_pch_config_for(nocc_darray(const char*) cmd) {
+    if(_nocc_pch.header == NULL || nocc_da_size(cmd) == 0) return NULL;
+    if(_nocc_cmd_find_arg(cmd, "-c") == nocc_da_size(cmd)) return NULL;
+    const char* source = _nocc_compdb_source(cmd);
+    if(source == NULL) return NULL;
+
+    const char* language = _nocc_pch_language(strrchr(source, '.') + 1);
+    if(language == NULL) return NULL;
+
+    uint64_t key = nocc_hash_cstr(language, nocc_hash_cstr(_nocc_pch.header, 0));
+    for(size_t i = 0; i < nocc_da_size(cmd); i++) {
+        const char* arg = cmd[i];
+        if(arg == source || strcmp(arg, "-c") == 0) continue;
+        if(strcmp(arg, "-MMD") == 0 || strcmp(arg, "-MD") == 0 || strcmp(arg, "-MP") == 0) continue;
+        if(strcmp(arg, "-o") == 0 || strcmp(arg, "-MF") == 0 || strcmp(arg, "-MT") == 0 || strcmp(arg, "-MQ") == 0) { i++; continue; }
+        key = nocc_hash(arg, strlen(arg) + 1, key);
+    }
+
+    for(size_t i = 0; i < nocc_da_size(_nocc_pch.configs); i++) {
+        if(_nocc_pch.configs[i]->key == key) return _nocc_pch.configs[i];
+    }
+    _nocc_pch_config* config = _nocc_pch_config_create(cmd, source, key, language);
+    nocc_da_push(_nocc_pch.configs, config);
+    return config;
+}
+
+// The precompiled header target of the command, for the graph to schedule before it. NULL if it has none.
+nocc_target* _nocc_pch_target(nocc_darray(const char*) cmd) {
+    _nocc_pch_config* config = _nocc_pch_config_for(cmd);
+    return config ? config->target : NULL;
+}
+
+// Called for every target the graph finishes, takes note of how a precompiled header went
+void _nocc_pch_finished(nocc_target* target) {
+    if(!target->_optional || _nocc_pch.header == NULL) return;
+    for(size_t i = 0; i < nocc_da_size(_nocc_pch.configs); i++) {
+        _nocc_pch_config* config = _nocc_pch.configs[i];
+        if(config->target != target) continue;
+
+        config->checked = true;
+        config->ok = target->_state == NOCC_TS_UP_TO_DATE || target->_state == NOCC_TS_REBUILT;
+        config->rebuilt = target->_state == NOCC_TS_REBUILT;
+        if(target->_state == NOCC_TS_FAILED) {
+            nocc_warn("Could not precompile %s, compiling without it", _nocc_pch.header);
+            remove(target->name);
+        }
+        return;
+    }
+}
+
+// The precompiled header for the command, brought up to date. NULL if the command does not compile a C/C++ source or the header failed to build.
+// Outside of a graph build the header is built here, before the command.
+_nocc_pch_config* _nocc_pch_prepare(nocc_darray(const char*) cmd) {
+    _nocc_pch_config* config = _nocc_pch_config_for(cmd);
+    if(config == NULL) return NULL;
+    if(config->checked) return config->ok ? config : NULL;
+
+    nocc_target* target = config->target;
+    target->_state = NOCC_TS_UP_TO_DATE;
+    if(_nocc_target_is_stale(target)) {
+        nocc_info("Building %s", target->name);
+        int64_t start = nocc_now_ns();
+        _nocc_target_snapshot(target);
+        pid cpid = _nocc_cmd_run_command_async(target->cmd);
+        bool ok = cpid != NOCC_INVALID_PID && _nocc_cmd_pid_wait(cpid) == 0;
+        nocc_stat_cache_invalidate(target->name);
+        nocc_stat_cache_invalidate(target->depfile);
+        nocc_trace_span("pch", target->name, start);
+
+        if(ok) _nocc_target_record(target, nocc_now_ns() - start);
+        nocc_db_snapshot_free(&target->_snapshot);
+        target->_state = ok ? NOCC_TS_REBUILT : NOCC_TS_FAILED;
+    }
+    _nocc_pch_finished(target);
+    return config->ok ? config : NULL;
+}
+
+// Tells whether the outputs of the target are older than its precompiled header, which is up to date by the time the target is checked.
+// Compilers do not list a precompiled header in the depfile (GCC), so the depfile alone misses it.
+bool _nocc_pch_outdates(nocc_target* target) {
+    _nocc_pch_config* config = _nocc_pch_prepare(target->cmd);
+    if(config == NULL) return false;
+    if(config->rebuilt) return true;
+    for(size_t i = 0; i < nocc_da_size(target->outputs); i++) {
+        if(nocc_should_recompile(&config->target->name, 1, target->outputs[i])) return true;
+    }
+    return false;
+}
+
+// The command with the flags of its precompiled header right after the compiler, NULL if there is none
+nocc_darray(const char*) _nocc_pch_apply(nocc_darray(const char*) cmd) {
+    // Already applied, e.g. a cached compile going through the pool
+    if(nocc_da_size(cmd) > 1 && (strcmp(cmd[1], "-include-pch") == 0 || strcmp(cmd[1], "-Winvalid-pch") == 0)) return NULL;
+    _nocc_pch_config* config = _nocc_pch_prepare(cmd);
+    if(config == NULL) return NULL;
+
+    nocc_darray(const char*) applied = nocc_da_reserve(const char*, nocc_da_size(cmd) + nocc_da_size(config->flags) + 1);
+    nocc_da_push(applied, cmd[0]);
+    nocc_da_pushn(applied, nocc_da_size(config->flags), config->flags);
+    nocc_da_pushn(applied, nocc_da_size(cmd) - 1, cmd + 1);
+    return applied;
+}
+
+// Precompiled Header End =================================================
+
+// Watch Begin ============================================================
+
+/**
+ * @brief Watches directories for changes (inotify), so a build can be redone as soon as a file is saved.
+*/
+typedef struct {
+    int fd;
+    nocc_darray(int) wds;           // parallel to dirs
+    nocc_darray(char*) dirs;
+    const nocc_filter* filter;      // (optional) changes to what it does not keep are ignored, see nocc_watch_filter
+    bool overflow;                  // events were lost, everything has to be considered changed
+    nocc_darray(char*) created;     // the files among the changed ones that were created or moved in
+} nocc_watch;
+
+/**
+ * @brief Initializes the watcher.
+ * 
+ * @param {nocc_watch*} watch -- The watcher
+ * 
+ * @return {bool} false if watching is not supported.
+*/
+bool nocc_watch_init(nocc_watch* watch) {
+    watch->wds = nocc_da_create(int);
+    watch->dirs = nocc_da_create(char*);
+    watch->filter = NULL;
+    watch->overflow = false;
+    watch->created = nocc_da_create(char*);
+#ifdef __linux__
+    watch->fd = inotify_init1(IN_CLOEXEC);
+    if(watch->fd < 0) {
+        nocc_error("Could not initialize inotify: %s", strerror(errno));
+        return false;
+    }
+    return true;
+#else
+    watch->fd = -1;
+    nocc_error("Watching is only supported on linux");
+    return false;
+#endif // __linux__
+}
+
+void nocc_watch_free(nocc_watch* watch) {
+#ifdef __linux__
+    if(watch->fd >= 0) close(watch->fd);
+#endif // __linux__
+    for(size_t i = 0; i < nocc_da_size(watch->dirs); i++) free(watch->dirs[i]);
+    for(size_t i = 0; i < nocc_da_size(watch->created); i++) free(watch->created[i]);
+    nocc_da_free(watch->dirs);
+    nocc_da_free(watch->wds);
+    nocc_da_free(watch->created);
+}
+
+/**
+ * @brief Ignores changes to whatever the filter does not keep, usually the one the sources were scanned with.
+ * Without it the build's own outputs (objects, .nocc_db, the binary) wake the watcher up again after every build.
+ * Paths are matched relative to the working directory, like nocc_read_dir_filtered(".", ...) sees them.
+ * 
+ * @param {nocc_watch*} watch -- The watcher
+ * @param {const nocc_filter*} filter -- The filter, it has to outlive the watcher. NULL reports every change.
+ * 
+ * @return {void}
+*/
+void nocc_watch_filter(nocc_watch* watch, const nocc_filter* filter) {
+    watch->filter = filter;
+}
+
+/**
+ * @brief Watches a single directory (not recursively). Directories created or moved inside it later are watched automatically.
+ * 
+ * @param {nocc_watch*} watch -- The watcher
+ * @param {const char*} dir -- The directory
+ * 
+ * @return {bool}
+*/
+bool nocc_watch_add(nocc_watch* watch, const char* dir) {
+#ifdef __linux__
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ONLYDIR;
+    int wd = inotify_add_watch(watch->fd, dir, mask);
+    if(wd < 0) {
+        nocc_error("Could not watch %s: %s", dir, strerror(errno));
+        return false;
+    }
+
+    // inotify hands out the same wd when a directory is added twice
+    for(size_t i = 0; i < nocc_da_size(watch->wds); i++) {
+        if(watch->wds[i] == wd) return true;
+    }
+    nocc_da_push(watch->wds, wd);
+    nocc_da_push(watch->dirs, strdup(dir));
+    return true;
+#else
+    (void)watch; (void)dir;
+    return false;
+#endif // __linux__
+}
+
+/**
+ * @brief Watches the directories the files are in, e.g. the sources found by nocc_read_dir. Each directory is added once.
+ * 
+ * @param {nocc_watch*} watch -- The watcher
+ * @param {const char**} files -- The files
+ * @param {size_t} files_size -- The amount of files
+ * 
+ * @return {bool} false if any of the directories could not be watched.
+*/
+bool nocc_watch_add_files(nocc_watch* watch, const char** files, size_t files_size) {
+    bool status = true;
+    const char* previous = NULL;
+    size_t previous_length = 0;
+
+    for(size_t i = 0; i < files_size; i++) {
+        const char* slash = strrchr(files[i], '/');
+        size_t length = slash ? (size_t)(slash - files[i]) : 0;
+
+        // nocc_read_dir lists a directory's files next to each other
+        if(previous && length == previous_length && strncmp(previous, files[i], length) == 0) continue;
+        previous = files[i];
+        previous_length = length;
+
+        nocc_string dir = nocc_str_create();
+        if(length > 0) {
+            nocc_da_pushn(dir, length, (void*)files[i]);
+        } else {
+            nocc_str_push_char(dir, '.');
+        }
+        nocc_str_push_null(dir);
+        if(!nocc_watch_add(watch, dir)) status = false;
+        nocc_str_free(dir);
+    }
+    return status;
+}
+
+#ifdef __linux__
+// Adds the path to the changed paths unless it is already in there
+void _nocc_watch_report(nocc_darray(char*)* changed, const char* path) {
+    for(size_t i = 0; i < nocc_da_size(*changed); i++) {
+        if(strcmp((*changed)[i], path) == 0) return;
+    }
+    nocc_da_push(*changed, strdup(path));
+}
+
+// Watches a directory that showed up and whatever is below it. Files can be written into it (mkdir -p a/b && cp x.c a/b)
+// before the watch is in place, and a directory moved in brings its files along, so everything already in it is reported.
+void _nocc_watch_add_tree(nocc_watch* watch, const char* dir, nocc_darray(char*)* changed) {
+    if(!nocc_watch_add(watch, dir)) return;
+
+    nocc_string names = nocc_str_create();
+    nocc_darray(_nocc_dir_entry) entries = nocc_da_create(_nocc_dir_entry);
+    if(_nocc_read_dir_single_dir(dir, &names, &entries)) {
+        for(size_t i = 0; i < nocc_da_size(entries); i++) {
+            nocc_string path = nocc_str_create();
+            nocc_str_push_cstr(path, dir);
+            nocc_str_push_char(path, '/');
+            nocc_str_push_cstr(path, names + entries[i].name);
+            nocc_str_push_null(path);
+
+            nocc_file_type type = entries[i].type;
+            if(type == _NOCC_FT_LINK) {
+                struct stat st;
+                type = stat(path, &st) != 0 ? NOCC_FT_UNKNOWN : S_ISDIR(st.st_mode) ? NOCC_FT_DIRECTORY : NOCC_FT_FILE;
+            }
+            bool is_dir = type == NOCC_FT_DIRECTORY;
+            if(type != NOCC_FT_UNKNOWN && (!watch->filter || nocc_filter_keeps(watch->filter, _nocc_path_skip_dot(path), is_dir))) {
+                if(is_dir) {
+                    _nocc_watch_add_tree(watch, path, changed);
+                } else {
+                    _nocc_watch_report(changed, path);
+                    _nocc_watch_report(&watch->created, path);
+                }
+            }
+            nocc_str_free(path);
+        }
+    }
+    nocc_da_free(entries);
+    nocc_str_free(names);
+}
+#endif // __linux__
+
+/**
+ * @brief Blocks until something in the watched directories changes. Bursts of events (an editor saving, a git checkout)
+ * are coalesced: after the first event, this keeps collecting until nothing happened for `debounce_ms`.
+ * If the kernel dropped events, watch->overflow is set and every file has to be considered changed.
+ * The files that showed up (created or moved in) are also listed in watch->created, until the next wait.
+ * 
+ * @param {nocc_watch*} watch -- The watcher
+ * @param {int} debounce_ms -- how long it has to be quiet before returning
+ * @param {nocc_darray(char*)*} changed -- receives the changed paths (each once), the caller frees them.
+ * 
+ * @return {bool} false if waiting failed.
+*/
+bool nocc_watch_wait(nocc_watch* watch, int debounce_ms, nocc_darray(char*)* changed) {
+#ifdef __linux__
+    nocc_log_flush();
+    watch->overflow = false;
+    for(size_t i = 0; i < nocc_da_size(watch->created); i++) free(watch->created[i]);
+    nocc_da_clear(watch->created);
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int timeout = -1;
+
+    for(;;) {
+        struct pollfd pfd = { .fd = watch->fd, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, timeout);
+        if(ready < 0) {
+            if(errno == EINTR) continue;
+            nocc_error("Could not wait for changes: %s", strerror(errno));
+            return false;
+        }
+        if(ready == 0) return true;
 
-            break;
+        ssize_t length = read(watch->fd, buffer, sizeof(buffer));
+        if(length < 0) {
+            if(errno == EINTR || errno == EAGAIN) continue;
+            nocc_error("Could not read changes: %s", strerror(errno));
+            return false;
         }
-    }
 
-    if (WIFSIGNALED(wstatus)) {
-        nocc_assert(false, "command process was terminated by %s", strsignal(WTERMSIG(wstatus)));
-    }
-#endif // _WIN32
-}
+        for(char* it = buffer; it < buffer + length;) {
+            struct inotify_event* event = (struct inotify_event*)it;
+            it += sizeof(struct inotify_event) + event->len;
 
-pid _nocc_cmd_run_command_async(nocc_darray(const char*) cmd) {
-#ifdef _WIN32
-    nocc_string built_command = nocc_str_create();
-    for(size_t i = 0; i < nocc_da_size(cmd); i++) {
-        nocc_str_push_cstr(built_command, cmd[i]);
-        nocc_str_push_char(built_command, ' ');
+            if(event->mask & IN_Q_OVERFLOW) { watch->overflow = true; continue; }
+            if(event->len == 0) continue;
+
+            size_t index = 0;
+            for(; index < nocc_da_size(watch->wds); index++) {
+                if(watch->wds[index] == event->wd) break;
+            }
+            if(index == nocc_da_size(watch->wds)) continue;
+
+            nocc_string path = nocc_str_create();
+            nocc_str_push_cstr(path, watch->dirs[index]);
+            nocc_str_push_char(path, '/');
+            nocc_str_push_cstr(path, event->name);
+            nocc_str_push_null(path);
+
+            bool is_dir = (event->mask & IN_ISDIR) != 0;
+            if(watch->filter && !nocc_filter_keeps(watch->filter, _nocc_path_skip_dot(path), is_dir)) {
+                nocc_str_free(path);
+                continue;
+            }
+            if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if(is_dir) _nocc_watch_add_tree(watch, path, changed);
+                else       _nocc_watch_report(&watch->created, path);
+            }
+
+            _nocc_watch_report(changed, path);
+            nocc_str_free(path);
+        }
+
+        timeout = debounce_ms;
     }
-    nocc_str_push_null(built_command);
+#else
+    (void)watch; (void)debounce_ms; (void)changed;
+    return false;
+#endif // __linux__
+}
 
-    STARTUPINFO siStartInfo;
-    ZeroMemory(&siStartInfo, sizeof(siStartInfo));
-    siStartInfo.cb = sizeof(STARTUPINFO);
-    // NOTE: theoretically setting NULL to std handles should not be a problem
-    // https://docs.microsoft.com/en-us/windows/console/getstdhandle?redirectedfrom=MSDN#attachdetach-behavior
-    siStartInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-    // TODO: check for errors in GetStdHandle
-    siStartInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
-    siStartInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
-    siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
+// Watch End ==============================================================
 
-    PROCESS_INFORMATION piProcInfo;
-    ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
+// Server Begin ===========================================================
 
-    BOOL bSuccess =
-        CreateProcess(
-            NULL,
-            built_command,
-            NULL,
-            NULL,
-            TRUE,
-            0,
-            NULL,
-            NULL,
-            &siStartInfo,
-            &piProcInfo
-        );
+// A request is the command byte followed by the key, the client's stdout and stderr travel along with it (SCM_RIGHTS).
+// The reply is a single byte, the exit status of the build or _NOCC_SERVE_REFUSED.
+#define _NOCC_SERVE_BUILD       'b'
+#define _NOCC_SERVE_STOP        's'
+#define _NOCC_SERVE_REFUSED     255
+#define _NOCC_SERVE_KEY_MAX     256
+#define _NOCC_SERVE_TIMEOUT_MS  2000    // how long a client that connected has to send its request
 
-    if (!bSuccess) {
-        // TODO: Improve error handling
-        nocc_assert(false, "Failed to fork child process");
-        return NULL;
+#ifndef _WIN32
+bool _nocc_serve_address(const char* socket_path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address->sun_path)) {
+        nocc_error("Socket path %s is too long", socket_path);
+        return false;
     }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
 
-    CloseHandle(piProcInfo.hThread);
+int _nocc_serve_connect(const char* socket_path) {
+    struct sockaddr_un address;
+    if(!_nocc_serve_address(socket_path, &address)) return -1;
 
-    nocc_str_free(built_command);
-    return piProcInfo.hProcess;
-#else // ifndef _WIN32
-    pid_t cpid = fork();
-    if(cpid == -1) {
-        nocc_assert(false, "Failed to fork child process %s", strerror(errno));
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
         return -1;
     }
+    return fd;
+}
 
-    if(cpid == 0) {
-        if(execvp(cmd[i], cmd + 1) == -1) {
-            nocc_assert(false, "Failed to execute cmd %s", strerror(errno));
-            return -1;
-        }
-    }
+// Sends the request and returns the reply, -1 if there is no server to answer it
+int _nocc_serve_request(const char* socket_path, char command, const char* key) {
+    int fd = _nocc_serve_connect(socket_path);
+    if(fd < 0) return -1;
 
-    return cpid;
+    char message[1 + _NOCC_SERVE_KEY_MAX] = { command };
+    size_t length = key ? strlen(key) : 0;
+    if(length >= _NOCC_SERVE_KEY_MAX) length = _NOCC_SERVE_KEY_MAX - 1;
+    if(length) memcpy(message + 1, key, length);
 
-#endif // _WIN32
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = { .iov_base = message, .iov_len = 1 + length + 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer) };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // The server writes to the same stdout, whatever is buffered here has to come first
+    nocc_log_flush();
+    fflush(stderr);
+
+    int reply = -1;
+    if(sendmsg(fd, &msg, MSG_NOSIGNAL) >= 0) {
+        unsigned char status;
+        ssize_t got;
+        while((got = read(fd, &status, 1)) < 0 && errno == EINTR) {}
+        if(got == 1) reply = status;
+    }
+    close(fd);
+    return reply;
 }
+#endif // _WIN32
 
-bool nocc_cmd_execute(nocc_darray(const char*) cmd) {
-    _nocc_cmd_pid_wait(_nocc_cmd_run_command_async(cmd));
-    return true;
+/**
+ * @brief Asks the server listening on socket_path (see nocc_serve) to build, its output goes to this process' stdout and stderr.
+ * A no-op build then costs a connect and whatever the server has to check for the files that changed since the last one.
+ * 
+ * @param {const char*} socket_path -- the socket the server listens on
+ * @param {const char*} key -- has to match the key the server was started with, e.g. the configuration. 
+ * 
+ * @return {int} the exit status of the build, or -1 if there is no server, it has a different key, or the build script
+ * was rebuilt since it started. Build in-process in that case.
+*/
+int nocc_client_build(const char* socket_path, const char* key) {
+#ifdef _WIN32
+    (void)socket_path; (void)key;
+    return -1;
+#else
+    int reply = _nocc_serve_request(socket_path, _NOCC_SERVE_BUILD, key);
+    return reply == _NOCC_SERVE_REFUSED ? -1 : reply;
+#endif // _WIN32
 }
 
 /**
- * @brief determines whether the file should be recompiled or not.
+ * @brief Stops the server listening on socket_path.
  * 
- * @param {const char**} inputfiles -- an array (or pointer to) a filename
- * @param {size_t} input_files_size -- the length of the input files array (or 1) if it is a pointer.
- * @param {const char*} outputfile  -- the name of the target file 
+ * @param {const char*} socket_path -- the socket the server listens on
  * 
- * @return {bool} return's true, if needs to rebuild 
+ * @return {bool} false if no server was listening.
 */
-bool nocc_should_recompile(const char** inputfiles, size_t input_files_size, const char* outputfile) {
+bool nocc_client_stop(const char* socket_path) {
 #ifdef _WIN32
-    BOOL status;
-    
-    HANDLE output_file_fd = CreateFile(outputfile, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, NULL);
-    if(output_file_fd == INVALID_HANDLE_VALUE) {
-        if(GetLastError() == ERROR_FILE_NOT_FOUND) return true;
-        nocc_error("File not found (%s)", outputfile);
-        return true;
+    (void)socket_path;
+    return false;
+#else
+    return _nocc_serve_request(socket_path, _NOCC_SERVE_STOP, NULL) >= 0;
+#endif // _WIN32
+}
+
+#ifdef __linux__
+typedef struct {
+    const char* key;
+    char binary[4096];
+    struct stat binary_stat;
+    nocc_darray(char*) changed;     // since the last build
+    bool full;                      // the next build has to check everything
+    char* unknown;                  // a file that showed up and is not part of the graph, a plain build would see it
+} _nocc_server;
+
+// The client re-executes a rebuilt build script, the graph held here would be the old one then
+bool _nocc_serve_binary_changed(_nocc_server* server) {
+    struct stat st;
+    if(server->binary[0] == '\0' || stat(server->binary, &st) != 0) return server->binary[0] != '\0';
+    return st.st_ino != server->binary_stat.st_ino || st.st_dev != server->binary_stat.st_dev
+        || st.st_mtim.tv_sec != server->binary_stat.st_mtim.tv_sec || st.st_mtim.tv_nsec != server->binary_stat.st_mtim.tv_nsec;
+}
+
+// Whether the file is an input or an output of a target, "./src/a.c" and "src/a.c" are the same file
+bool _nocc_serve_in_graph(nocc_graph* graph, const char* file) {
+    file = _nocc_path_skip_dot(file);
+    for(size_t i = 0; i < nocc_da_size(graph->targets); i++) {
+        nocc_target* target = graph->targets[i];
+        for(size_t j = 0; j < nocc_da_size(target->inputs); j++) {
+            if(strcmp(_nocc_path_skip_dot(target->inputs[j]), file) == 0) return true;
+        }
+        for(size_t j = 0; j < nocc_da_size(target->outputs); j++) {
+            if(strcmp(_nocc_path_skip_dot(target->outputs[j]), file) == 0) return true;
+        }
     }
+    return false;
+}
 
-    FILETIME output_file_time;
-    status = GetFileTime(output_file_fd, NULL, NULL, &output_file_time);
-    CloseHandle(output_file_fd);
-    if(!status) { 
-        nocc_error("Could not obtain file time: %s (%s)", GetLastError(), outputfile);
-        return true;
+// Forgets the cached stats of the changed files and remembers them for the next build
+bool _nocc_serve_collect(_nocc_server* server, nocc_graph* graph, nocc_watch* watch) {
+    size_t first = nocc_da_size(server->changed);
+    if(!nocc_watch_wait(watch, 0, &server->changed)) return false;
+
+    // Without a filter the build's own scratch files show up as well, there is no telling a new source from them
+    for(size_t i = 0; i < nocc_da_size(watch->created) && watch->filter && server->unknown == NULL; i++) {
+        struct stat st;
+        if(stat(watch->created[i], &st) == 0 && S_ISREG(st.st_mode) && !_nocc_serve_in_graph(graph, watch->created[i])) {
+            server->unknown = strdup(watch->created[i]);
+        }
     }
 
-    for(size_t i = 0; i < input_files_size; i++) {
-        const char* inputfile = inputfiles[i];
+    if(watch->overflow) {
+        // Lost events can be about any file
+        nocc_stat_cache_end();
+        nocc_stat_cache_begin();
+        server->full = true;
+    }
+    for(size_t i = first; i < nocc_da_size(server->changed); i++) {
+        nocc_stat_cache_invalidate(server->changed[i]);
+    }
+    return true;
+}
 
-        HANDLE input_file_fd = CreateFile(inputfile, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_READONLY, NULL);
-        if(input_file_fd == INVALID_HANDLE_VALUE) {
-            if(GetLastError() == ERROR_FILE_NOT_FOUND) return true;
-            nocc_error("File not found (%s)", inputfile);
-            return true;
+bool _nocc_serve_pending(nocc_watch* watch) {
+    struct pollfd pfd = { .fd = watch->fd, .events = POLLIN, .revents = 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+int _nocc_serve_build(_nocc_server* server, nocc_graph* graph, nocc_jobs* jobs) {
+    bool status;
+    if(server->full) {
+        status = nocc_graph_build(graph, jobs);
+    } else {
+        status = nocc_graph_build_changed(graph, jobs, (const char**)server->changed, nocc_da_size(server->changed));
+    }
+
+    for(size_t i = 0; i < nocc_da_size(server->changed); i++) free(server->changed[i]);
+    nocc_da_free(server->changed);
+    server->changed = nocc_da_create(char*);
+    // Failed targets have to be tried again even if nothing changed
+    server->full = !status;
+    return status ? 0 : 1;
+}
+
+// Runs one request, returns false when the server should stop
+bool _nocc_serve_client(_nocc_server* server, int client, nocc_graph* graph, nocc_jobs* jobs, nocc_watch* watch) {
+    char message[1 + _NOCC_SERVE_KEY_MAX + 1] = "";
+    int fds[2] = { -1, -1 };
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = { .iov_base = message, .iov_len = sizeof(message) - 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer) };
+
+    // The clients are served one at a time, one that connects and never sends would wedge the server for everyone else
+    struct timeval timeout = { .tv_sec = _NOCC_SERVE_TIMEOUT_MS / 1000, .tv_usec = (_NOCC_SERVE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t length;
+    while((length = recvmsg(client, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+    if(length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) nocc_warn("A client connected but sent nothing, dropping it");
+    if(length <= 0) return true;
+
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
         }
+    }
 
-        FILETIME input_file_time;
-        status = GetFileTime(input_file_fd, NULL, NULL, &input_file_time);
-        CloseHandle(input_file_fd);
-        if(!status) { 
-            nocc_error("Could not obtain file time: %s (%s)", GetLastError(), inputfile);
-            return true;
+    bool keep_serving = true;
+    unsigned char reply = _NOCC_SERVE_REFUSED;
+    const char* key = message + 1;
+
+    if(message[0] == _NOCC_SERVE_STOP) {
+        reply = 0;
+        keep_serving = false;
+    } else if(message[0] != _NOCC_SERVE_BUILD || fds[0] < 0 || strcmp(key, server->key ? server->key : "") != 0) {
+        reply = _NOCC_SERVE_REFUSED;
+    } else if(_nocc_serve_binary_changed(server)) {
+        nocc_info("The build script changed, stopping");
+        keep_serving = false;
+    } else if(_nocc_serve_pending(watch) && !_nocc_serve_collect(server, graph, watch)) {
+        // A file saved right before the client started may not have been read yet
+        keep_serving = false;
+    } else if(server->unknown) {
+        nocc_info("%s is not part of the graph, stopping", server->unknown);
+        keep_serving = false;
+    } else {
+        nocc_log_flush();
+        fflush(stderr);
+        int saved_stdout = dup(STDOUT_FILENO);
+        int saved_stderr = dup(STDERR_FILENO);
+        dup2(fds[0], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+
+        reply = (unsigned char)_nocc_serve_build(server, graph, jobs);
+
+        nocc_log_flush();
+        fflush(stderr);
+        dup2(saved_stdout, STDOUT_FILENO);
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stdout);
+        close(saved_stderr);
+    }
+
+    if(fds[0] >= 0) close(fds[0]);
+    if(fds[1] >= 0) close(fds[1]);
+    send(client, &reply, 1, MSG_NOSIGNAL);
+    return keep_serving;
+}
+#endif // __linux__
+
+/**
+ * @brief Keeps the graph, the stats of the files and the build database in memory and builds whenever a client asks
+ * (nocc_client_build), until a client stops it (nocc_client_stop) or the build script is rebuilt. The watcher keeps the
+ * state fresh, so a build only checks the files that changed since the last one, like nocc_graph_build_changed.
+ * Add the directories of every input to the watcher, e.g. with nocc_watch_add_files on the result of nocc_read_dir,
+ * and give it the filter the sources were scanned with (nocc_watch_filter). When a file the filter keeps shows up and is not
+ * an input of any target, the graph is out of date: the server stops and refuses the build, so the client builds in-process.
+ * 
+ * @param {const char*} socket_path -- the unix socket to listen on, replaced if no server is listening on it anymore
+ * @param {const char*} key -- the key clients have to send, e.g. the configuration the graph was made for
+ * @param {nocc_graph*} graph -- The graph
+ * @param {nocc_jobs*} jobs -- The pool to run the commands in
+ * @param {nocc_watch*} watch -- the watcher
+ * 
+ * @return {bool} false if the server could not be started.
+*/
+bool nocc_serve(const char* socket_path, const char* key, nocc_graph* graph, nocc_jobs* jobs, nocc_watch* watch) {
+#ifdef __linux__
+    struct sockaddr_un address;
+    if(!_nocc_serve_address(socket_path, &address)) return false;
+
+    int running = _nocc_serve_connect(socket_path);
+    if(running >= 0) {
+        close(running);
+        nocc_error("A server is already listening on %s", socket_path);
+        return false;
+    }
+    // Left behind by a server that did not get to clean up
+    unlink(socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+        nocc_error("Could not listen on %s: %s", socket_path, strerror(errno));
+        if(listener >= 0) close(listener);
+        return false;
+    }
+
+    _nocc_server server = { .key = key, .changed = nocc_da_create(char*), .full = true };
+    ssize_t length = readlink("/proc/self/exe", server.binary, sizeof(server.binary) - 1);
+    if(length > 0 && stat(server.binary, &server.binary_stat) == 0) server.binary[length] = '\0';
+    else server.binary[0] = '\0';
+
+    // A client that goes away mid-build must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    // Stays open for the lifetime of the server, the watcher invalidates what changed
+    nocc_stat_cache_begin();
+
+    nocc_info("Serving on %s", socket_path);
+    for(bool serving = true; serving;) {
+        nocc_log_flush();
+        struct pollfd pfds[2] = {
+            { .fd = listener, .events = POLLIN, .revents = 0 },
+            { .fd = watch->fd, .events = POLLIN, .revents = 0 },
+        };
+        if(poll(pfds, 2, -1) < 0) {
+            if(errno == EINTR) continue;
+            nocc_error("Could not wait for clients: %s", strerror(errno));
+            break;
         }
 
-        if(CompareFileTime(&input_file_time, &output_file_time) == 1) return true;
+        if(pfds[1].revents & POLLIN) {
+            if(!_nocc_serve_collect(&server, graph, watch)) break;
+        }
+        if(pfds[0].revents & POLLIN) {
+            int client = accept(listener, NULL, NULL);
+            if(client < 0) continue;
+            fcntl(client, F_SETFD, FD_CLOEXEC);
+            serving = _nocc_serve_client(&server, client, graph, jobs, watch);
+            close(client);
+        }
     }
 
+    nocc_stat_cache_end();
+    close(listener);
+    unlink(socket_path);
+    for(size_t i = 0; i < nocc_da_size(server.changed); i++) free(server.changed[i]);
+    nocc_da_free(server.changed);
+    free(server.unknown);
+    return true;
+#else
+    (void)socket_path; (void)key; (void)graph; (void)jobs; (void)watch;
+    nocc_error("Serving is only supported on linux");
     return false;
+#endif // __linux__
+}
+
+// Server End =============================================================
+
+// Rebuild Begin ==========================================================
+
+#ifndef NOCC_REBUILD_CC
+    #define NOCC_REBUILD_CC "cc"
+#endif // NOCC_REBUILD_CC
+
+// The arguments after the source, separated by commas. nocc.h starts threads, which older libcs only link with -pthread.
+#ifndef NOCC_REBUILD_FLAGS
+    #ifdef _WIN32
+        #define NOCC_REBUILD_FLAGS
+    #else
+        #define NOCC_REBUILD_FLAGS "-pthread"
+    #endif // _WIN32
+#endif // NOCC_REBUILD_FLAGS
+
+// __FILE__ here is nocc.h as the build script included it
+static const char* _nocc_header_file = __FILE__;
+
+/**
+ * @brief Rebuilds the build script when its source or nocc.h is newer than the running binary, then re-executes it
+ * with the same arguments. When the binary is fresh this costs three stats. Call it first thing in main.
+ * The paths of the sources are the ones the script was compiled with, so run it from the directory it was compiled in.
+ * Define NOCC_REBUILD_CC to use a different compiler than "cc" (a single program, no arguments), and NOCC_REBUILD_FLAGS
+ * for the arguments it gets after the source, e.g. `#define NOCC_REBUILD_FLAGS "-pthread", "-O2"`. They default to
+ * "-pthread" outside of windows.
+ * 
+ * @param {int} argc -- the arg counter passed into main
+ * @param {char**} argv -- the arguments passed into main
+ * 
+ * @return {void} returns only if the binary is fresh (or could not be checked).
+*/
+#define NOCC_REBUILD_SELF(argc, argv)   _nocc_rebuild_self((argc), (argv), __FILE__)
+
+void _nocc_rebuild_self(int argc, char** argv, const char* source) {
+    char binary[4096] = "";
+#if defined(_WIN32)
+    DWORD length = GetModuleFileNameA(NULL, binary, sizeof(binary));
+    if(length == 0 || length == sizeof(binary)) return;
+#elif defined(__linux__)
+    ssize_t length = readlink("/proc/self/exe", binary, sizeof(binary) - 1);
+    if(length <= 0) return;
+    binary[length] = '\0';
 #else
-    // of course everything is easier on linux.
-    struct stat statbuf = {0};
+    if(argc < 1 || strlen(argv[0]) >= sizeof(binary)) return;
+    strcpy(binary, argv[0]);
+#endif
 
-    if (stat(outputfile, &statbuf) < 0) {
-        // NOTE: if output does not exist it 100% must be rebuilt
-        if (errno == ENOENT) return true;
-        nocc_error("could not stat %s: %s", outputfile, strerror(errno));
-        return true;
+    nocc_file_time binary_time, source_time;
+    if(!nocc_get_file_time(binary, &binary_time, NULL)) return;
+
+    // A missing source means the script runs from somewhere else, there is nothing to compare against then
+    bool stale = false;
+    const char* sources[] = { source, _nocc_header_file };
+    for(size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        if(nocc_get_file_time(sources[i], &source_time, NULL) && source_time > binary_time) stale = true;
+    }
+    if(!stale) return;
+
+    nocc_info("Rebuilding %s", binary);
+
+    // The running binary cannot be overwritten on windows, but it can be moved out of the way
+    nocc_string old = nocc_str_create();
+    nocc_str_push_cstr(old, binary);
+    nocc_str_push_cstr(old, ".old");
+    nocc_str_push_null(old);
+    if(!_nocc_rename_file(binary, old)) {
+        nocc_error("Could not move %s out of the way", binary);
+        exit(1);
     }
-    int output_file_time = statbuf.st_mtime;
 
-    for (size_t i = 0; i < input_files_size; ++i) {
-        const char *inputfile = inputfiles[i];
-        if (stat(inputfile, &statbuf) < 0) {
-            // NOTE: non-existing input is an error cause it is needed for building in the first place
-            nocc_error("could not stat %s: %s", inputfile, strerror(errno));
-            return true;
-        }
-        int input_file_time = statbuf.st_mtime;
-        // NOTE: if even a single inputfile is fresher than outputfile that's 100% rebuild
-        if (input_file_time > output_file_time) return 1;
+    // The trailing comma keeps this valid when NOCC_REBUILD_FLAGS is empty
+    const char* rebuild[] = { NOCC_REBUILD_CC, "-o", binary, source, NOCC_REBUILD_FLAGS };
+    nocc_darray(const char*) cmd = nocc_da_create(const char*);
+    nocc_cmd_addn(cmd, sizeof(rebuild) / sizeof(rebuild[0]), rebuild);
+    bool status = nocc_cmd_execute(cmd);
+    nocc_da_free(cmd);
+
+    if(!status) {
+        nocc_error("Could not rebuild %s", binary);
+        _nocc_rename_file(old, binary);
+        exit(1);
     }
 
-    return 0;
-#endif // _WIN32
-}
+#ifdef _WIN32
+    nocc_str_free(old);
 
-bool nocc_should_recompile1(const char* inputfile, const char* outputfile) {
-    return nocc_should_recompile(&inputfile, 1, outputfile);
+    nocc_darray(const char*) args = nocc_da_create(const char*);
+    nocc_da_push(args, (const char*)binary);
+    if(argc > 1) nocc_da_pushn(args, argc - 1, argv + 1);
+
+    pid child = _nocc_cmd_run_command_async(args);
+    nocc_da_free(args);
+    exit(child == NOCC_INVALID_PID ? 1 : _nocc_cmd_pid_wait(child));
+#else
+    remove(old);
+    nocc_str_free(old);
+
+    (void)argc;
+    // The buffered lines would be gone with this process image
+    nocc_log_flush();
+    execv(binary, argv);
+    nocc_error("Could not re-execute %s: %s", binary, strerror(errno));
+    exit(1);
+#endif // _WIN32
 }
 
-// Command Ends
+// Rebuild End ============================================================
 
 // IMPLEMENTATION OF EXTERNAL FUNCTIONS ARE HERE
 
@@ -934,7 +6455,7 @@ void _nocc_da_free(void* array) {
 
 }
 
-void* _nocc_da_push(void* array, void* value) {
+void* _nocc_da_push(void* array, const void* value) {
     nocc_assert(array, "Please enter a valid array");
     nocc_assert(value, "Please enter a valid value (entered NULL)");
 
@@ -953,7 +6474,7 @@ void* _nocc_da_push(void* array, void* value) {
     return array;
 }
 
-void* _nocc_da_pushn(void* array, size_t n, void* value) {
+void* _nocc_da_pushn(void* array, size_t n, const void* value) {
     nocc_assert(array, "Please enter a valid array");
     nocc_assert(value, "Please enter a valid value (entered NULL)");
     nocc_assert(n > 0, "Please enter a valid value (entered NULL)");
@@ -994,14 +6515,14 @@ void* _nocc_da_remove(void* array, size_t index, void* output_ptr) {
     
     uint64_t addr = (uint64_t)array;
     if(output_ptr != NULL) {
-        memcpy(output_ptr, (array + index), header->stride);
+        memcpy(output_ptr, (void*)(addr + (index * header->stride)), header->stride);
     }
 
     if(index != header->size - 1) {
         memmove(
             (void*)(addr + (index * header->stride)),
             (void*)(addr + ((index + 1) * header->stride)),
-            header->stride * (header->size - (index - 1))
+            header->stride * (header->size - index - 1)
         );
     }
 
@@ -1009,19 +6530,25 @@ void* _nocc_da_remove(void* array, size_t index, void* output_ptr) {
     return array;
 }
 
-size_t _nocc_da_size(void* array) {
+void _nocc_da_clear(void* array) {
+    nocc_assert(array, "Please enter a valid array");
+    _nocc_da_header* header = _nocc_da_calc_header(array);
+    header->size = 0;
+}
+
+size_t _nocc_da_size(const void* array) {
     nocc_assert(array, "Please enter a valid array");
     _nocc_da_header* header = _nocc_da_calc_header(array);
     return header->size;
 }
 
-size_t _nocc_da_capacity(void* array) {
+size_t _nocc_da_capacity(const void* array) {
     nocc_assert(array, "Please enter a valid array");
     _nocc_da_header* header = _nocc_da_calc_header(array);
     return header->capacity;
 }
 
-size_t _nocc_da_stride(void* array) {
+size_t _nocc_da_stride(const void* array) {
     nocc_assert(array, "Please enter a valid array");
     _nocc_da_header* header = _nocc_da_calc_header(array);
     return header->stride;
@@ -1089,6 +6616,31 @@ bool _nocc_ap_get_option_status(nocc_argparse_opt* opt, bool is_long, char* arg)
     return true;
 }
 
+// Matches -jN, -j N, --jobs=N and --jobs N. The value is left in args until the option is removed.
+char* _nocc_ap_get_option_value(nocc_argparse_opt* opt, bool is_long, int beg, nocc_darray(char*) args, char* arg) {
+    char* value = NULL;
+    if(is_long == false) {
+        if(opt->short_name != arg[1]) return NULL;
+        value = arg + 2;
+    } else {
+        size_t length = strlen(opt->name);
+        if(strncmp(opt->name, arg + 2, length) != 0) return NULL;
+        value = arg + 2 + length;
+        if(*value == '=') value++;
+        else if(*value != '\0') return NULL;
+    }
+
+    if(*value != '\0') return value;
+    if(nocc_da_size(args) <= (size_t)beg + 1) {
+        nocc_error("Option %s requires a value", arg);
+        return NULL;
+    }
+
+    value = args[beg + 1];
+    nocc_da_remove(args, beg + 1, NULL);
+    return value;
+}
+
 bool _nocc_ap_parse_option(nocc_argparse_opt* command, int beg, nocc_darray(char*) args, char* arg) {
     if(command->options == NULL) return false;
     if(arg[0] != '-') return false;
@@ -1114,11 +6666,21 @@ bool _nocc_ap_parse_option(nocc_argparse_opt* command, int beg, nocc_darray(char
                 bool status = _nocc_ap_get_option_status(&(opt._children[i]), is_long, arg);
                 if(!status)
                     continue;
-                *(char**)(opt.output_ptr) = opt._children[i].name;
+                *(const char**)(opt.output_ptr) = opt._children[i].name;
                 nocc_da_remove(args, beg, NULL);
                 return true;
             }
         } break;
+        case NOCC_APT_NUMBER:
+        case NOCC_APT_STRING: {
+            char* value = _nocc_ap_get_option_value(&opt, is_long, beg, args, arg);
+            if(value == NULL)
+                break;
+            if(opt._type == NOCC_APT_NUMBER) *(long*)(opt.output_ptr) = strtol(value, NULL, 10);
+            else                             *(char**)(opt.output_ptr) = value;
+            nocc_da_remove(args, beg, NULL);
+            return true;
+        } break;
         default:
             break;
         }
@@ -1164,9 +6726,14 @@ void _nocc_ap_set_default_option(nocc_argparse_opt* command) {
                 break;
             *(char**)opt.output_ptr = (char*)opt.default_;
             break;
+
+        case NOCC_APT_NUMBER:
+            if(*(long*)opt.output_ptr != 0)
+                break;
+            *(long*)opt.output_ptr = strtol((const char*)opt.default_, NULL, 10);
+            break;
         
         case NOCC_APT_FLOAT:
-        case NOCC_APT_NUMBER:
         case NOCC_APT_UNKNOWN:
         case NOCC_APT_ARRAY:
         default:
@@ -1197,35 +6764,38 @@ void _nocc_ap_set_default(nocc_argparse_opt* command) {
 
 // FILE IMPLEMENTATION 
 
-nocc_file_type _nocc_get_file_type(const char* filepath) {
+// Symlinks are followed, like stat would
+nocc_file_type _nocc_dir_entry_type(DIR* dir, struct dirent* ent) {
 #ifdef _WIN32
-    DWORD attribute = GetFileAttributesA(filepath);
-    if(attribute == INVALID_FILE_ATTRIBUTES) {
-        nocc_error("Failed to get the file attribute %s: %S", filepath, GetLastError());
-        return NOCC_FT_UNKNOWN;
-    }
-
-    if(attribute & FILE_ATTRIBUTE_DIRECTORY) return NOCC_FT_DIRECTORY;
-    return NOCC_FT_FILE;
+    (void)ent;
+    return (dir->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? NOCC_FT_DIRECTORY : NOCC_FT_FILE;
 #else
-    struct stat statbuf;
-    if (stat(path, &statbuf) < 0) {
-        nocc_log_error("Could not get stat of %s: %s", path, strerror(errno));
-        return -1;
+    #ifdef _DIRENT_HAVE_D_TYPE
+    switch(ent->d_type) {
+    case DT_DIR:        return NOCC_FT_DIRECTORY;
+    case DT_REG:        return NOCC_FT_FILE;
+    case DT_LNK:        return _NOCC_FT_LINK;
+    case DT_UNKNOWN:    break;
+    default:            return NOCC_FT_UNKNOWN;
     }
-
-    switch (statbuf.st_mode & S_IFMT) {
-        case S_IFDIR:  return NOCC_FT_DIRECTORY;
-        case S_IFREG:  return NOCC_FT_FILE;
-        default:       return NOCC_FT_UNKNOWN;
-    }
-#endif
+    #endif // _DIRENT_HAVE_D_TYPE
+
+    // Some filesystems do not fill in d_type, the directory is still open so the name does not have to be resolved again
+    struct stat st;
+    if(fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) return NOCC_FT_UNKNOWN;
+    if(S_ISLNK(st.st_mode)) return _NOCC_FT_LINK;
+    if(S_ISDIR(st.st_mode)) return NOCC_FT_DIRECTORY;
+    if(S_ISREG(st.st_mode)) return NOCC_FT_FILE;
+    return NOCC_FT_UNKNOWN;
+#endif // _WIN32
 }
 
-bool _nocc_read_dir_single_dir(const char* src_dir, const char*** files) {
-    DIR* dir = NULL;
+// Reads the entries of a directory, without "." and "..". Both arrays are cleared first, so they can be reused.
+bool _nocc_read_dir_single_dir(const char* src_dir, nocc_string* names, nocc_darray(_nocc_dir_entry)* entries) {
+    nocc_da_clear(*names);
+    nocc_da_clear(*entries);
 
-    dir = opendir(src_dir);
+    DIR* dir = opendir(src_dir);
     if(dir == NULL) {
         nocc_error("Failed to open file %s: %s", src_dir, strerror(errno));
         return false;
@@ -1234,25 +6804,268 @@ bool _nocc_read_dir_single_dir(const char* src_dir, const char*** files) {
     errno = 0;
     struct dirent* ent = readdir(dir);
     while(ent != NULL) {
-        nocc_da_push(*files, strdup(ent->d_name));
+        const char* name = ent->d_name;
+        if(!(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))) {
+            _nocc_dir_entry entry = { .name = nocc_da_size(*names), .type = _nocc_dir_entry_type(dir, ent) };
+            nocc_da_pushn(*names, strlen(name) + 1, (void*)name);
+            nocc_da_push(*entries, entry);
+        }
+        errno = 0;
         ent = readdir(dir);
     }
 
+    bool status = true;
     if (errno != 0) {
         nocc_error("Could not read directory %s: %s", src_dir, strerror(errno));
+        status = false;
+    }
+
+    closedir(dir);
+    return status;
+}
+
+typedef struct _nocc_scan_t _nocc_scan_t;
+
+typedef struct {
+    _nocc_scan_t* scan;
+    _nocc_mutex lock;
+    nocc_darray(char*) dirs;        // the owner takes from the back (depth first), thieves from the front
+    size_t head;
+    nocc_darray(const char*) files;
+    nocc_string names;              // reused for every directory the worker reads
+    nocc_string path;
+    nocc_darray(_nocc_dir_entry) entries;
+    nocc_darray(_nocc_dir_record) fresh;   // listings that were not in the directory cache or outdated
+    bool failed;
+} _nocc_scan_worker;
+
+struct _nocc_scan_t {
+    const nocc_filter* filter;
+    size_t root_length;             // the path below the scanned directory starts after this
+    _nocc_scan_worker* workers;
+    size_t count;
+    size_t pending;                 // directories queued or being read, the scan is done at 0
+    _nocc_mutex idle_lock;
+    _nocc_cond idle;                // workers without a directory sleep on it
+    size_t wakeups;                 // bumped under idle_lock whenever a directory is queued or the scan is done
+};
+
+// Wakes one sleeping worker, or all of them once the scan is done
+void _nocc_scan_wake(_nocc_scan_t* scan, bool all) {
+    _nocc_mutex_lock(&scan->idle_lock);
+    scan->wakeups++;
+    if(all) _nocc_cond_broadcast(&scan->idle);
+    else    _nocc_cond_signal(&scan->idle);
+    _nocc_mutex_unlock(&scan->idle_lock);
+}
+
+void _nocc_scan_push(_nocc_scan_worker* worker, char* dir) {
+    __atomic_fetch_add(&worker->scan->pending, 1, __ATOMIC_ACQ_REL);
+    _nocc_mutex_lock(&worker->lock);
+    nocc_da_push(worker->dirs, dir);
+    _nocc_mutex_unlock(&worker->lock);
+    _nocc_scan_wake(worker->scan, false);
+}
+
+char* _nocc_scan_take(_nocc_scan_worker* worker, bool steal) {
+    char* dir = NULL;
+    _nocc_mutex_lock(&worker->lock);
+    size_t size = nocc_da_size(worker->dirs);
+    if(worker->head < size) {
+        if(steal) {
+            dir = worker->dirs[worker->head++];
+        } else {
+            nocc_da_remove(worker->dirs, size - 1, &dir);
+        }
+        if(worker->head == nocc_da_size(worker->dirs)) {
+            nocc_da_free(worker->dirs);
+            worker->dirs = nocc_da_create(char*);
+            worker->head = 0;
+        }
+    }
+    _nocc_mutex_unlock(&worker->lock);
+    return dir;
+}
+
+// The listing of the directory, from the directory cache if the directory did not change since it was read
+bool _nocc_scan_list(_nocc_scan_worker* worker, const char* dir, const char** names, const _nocc_dir_entry** entries) {
+    _nocc_dir_stamp stamp;
+    if(_nocc_dir_cache.path == NULL || !_nocc_dir_stamp_of(dir, &stamp)) {
+        bool status = _nocc_read_dir_single_dir(dir, &worker->names, &worker->entries);
+        *names = worker->names;
+        *entries = worker->entries;
+        return status;
+    }
+
+    // Every directory is read by one worker, nothing else writes to the records during a scan
+    _nocc_dir_record* cached = _nocc_dir_cache_find(dir);
+    if(cached && _nocc_dir_cache_fresh(cached, &stamp)) {
+        cached->used = true;
+        *names = cached->names;
+        *entries = cached->entries;
+        return true;
     }
 
-    if(dir)
-        closedir(dir);
+    _nocc_dir_record record = {
+        .path = strdup(dir), .stamp = stamp, .listed_at = _nocc_file_time_now(), .used = true,
+        .names = nocc_str_reserve(256), .entries = nocc_da_reserve(_nocc_dir_entry, 16),
+    };
+    bool status = _nocc_read_dir_single_dir(dir, &record.names, &record.entries);
+    if(!status) {
+        // A listing that failed part way is not cached, the next scan has to report the directory again.
+        // What was read is still scanned: it moves into the worker's buffers, which the record frees instead.
+        nocc_string names_read = record.names;
+        nocc_darray(_nocc_dir_entry) entries_read = record.entries;
+        record.names = worker->names;
+        record.entries = worker->entries;
+        worker->names = names_read;
+        worker->entries = entries_read;
+        _nocc_dir_record_free(&record);
+        *names = worker->names;
+        *entries = worker->entries;
+        return false;
+    }
+    nocc_da_push(worker->fresh, record);
+    *names = record.names;
+    *entries = record.entries;
     return true;
 }
 
-char* _nocc_get_basename(const char* dir, char* output) {
+void _nocc_scan_dir(_nocc_scan_worker* worker, const char* dir) {
+    const char* names;
+    const _nocc_dir_entry* entries;
+    if(!_nocc_scan_list(worker, dir, &names, &entries)) worker->failed = true;
+
+    for(size_t i = 0; i < nocc_da_size(entries); i++) {
+        const _nocc_dir_entry* entry = &entries[i];
+        if(entry->type == NOCC_FT_UNKNOWN) continue;
+
+        nocc_da_clear(worker->path);
+        nocc_str_push_cstr(worker->path, dir);
+        nocc_str_push_char(worker->path, '/');
+        nocc_str_push_cstr(worker->path, names + entry->name);
+        nocc_str_push_null(worker->path);
+
+        nocc_file_type type = entry->type;
+        if(type == _NOCC_FT_LINK) {
+            nocc_file_info info;
+            type = _nocc_stat_uncached(worker->path, &info) ? info.type : NOCC_FT_UNKNOWN;
+            if(type == NOCC_FT_UNKNOWN) continue;
+        }
+
+        bool is_dir = type == NOCC_FT_DIRECTORY;
+        // Anything excluded is left alone, directories are never opened
+        if(!nocc_filter_keeps(worker->scan->filter, worker->path + worker->scan->root_length, is_dir)) continue;
+
+        char* path = strdup(worker->path);
+        if(is_dir) _nocc_scan_push(worker, path);
+        else       nocc_da_push(worker->files, (const char*)path);
+    }
+}
+
 #ifdef _WIN32
-    return basename(dir, output);
+DWORD WINAPI _nocc_scan_run(LPVOID arg) {
 #else
-    return basename(dir);
-#endif
+void* _nocc_scan_run(void* arg) {
+#endif // _WIN32
+    _nocc_scan_worker* worker = arg;
+    _nocc_scan_t* scan = worker->scan;
+    size_t self = (size_t)(worker - scan->workers);
+
+    for(;;) {
+        // Read before looking for work, a directory queued after this point keeps the worker from sleeping
+        _nocc_mutex_lock(&scan->idle_lock);
+        size_t seen = scan->wakeups;
+        _nocc_mutex_unlock(&scan->idle_lock);
+        if(__atomic_load_n(&scan->pending, __ATOMIC_ACQUIRE) == 0) break;
+
+        char* dir = _nocc_scan_take(worker, false);
+        for(size_t i = 1; dir == NULL && i < scan->count; i++) {
+            dir = _nocc_scan_take(&scan->workers[(self + i) % scan->count], true);
+        }
+        if(dir == NULL) {
+            // Someone is still reading a directory that may have subdirectories
+            _nocc_mutex_lock(&scan->idle_lock);
+            while(scan->wakeups == seen) _nocc_cond_wait(&scan->idle, &scan->idle_lock);
+            _nocc_mutex_unlock(&scan->idle_lock);
+            continue;
+        }
+
+        _nocc_scan_dir(worker, dir);
+        free(dir);
+        // The subdirectories were counted before this, so pending cannot reach 0 early
+        if(__atomic_sub_fetch(&scan->pending, 1, __ATOMIC_ACQ_REL) == 0) _nocc_scan_wake(scan, true);
+    }
+    return 0;
+}
+
+size_t nocc_nprocs(void);
+
+bool _nocc_read_dir_parallel(const char* src_dir, const nocc_filter* filter, const char*** files) {
+    _nocc_scan_t scan = { .filter = filter, .root_length = strlen(src_dir) + 1, .pending = 0 };
+    scan.count = nocc_nprocs();
+    if(scan.count > NOCC_SCAN_MAX_THREADS) scan.count = NOCC_SCAN_MAX_THREADS;
+    if(scan.count == 0) scan.count = 1;
+
+    _nocc_mutex_init(&scan.idle_lock);
+    _nocc_cond_init(&scan.idle);
+    scan.workers = calloc(scan.count, sizeof(_nocc_scan_worker));
+    for(size_t i = 0; i < scan.count; i++) {
+        scan.workers[i].scan = &scan;
+        _nocc_mutex_init(&scan.workers[i].lock);
+        scan.workers[i].dirs = nocc_da_create(char*);
+        scan.workers[i].files = nocc_da_create(const char*);
+        scan.workers[i].names = nocc_str_reserve(4096);
+        scan.workers[i].path = nocc_str_reserve(256);
+        scan.workers[i].fresh = nocc_da_create(_nocc_dir_record);
+        scan.workers[i].entries = nocc_da_reserve(_nocc_dir_entry, 256);
+    }
+    _nocc_scan_push(&scan.workers[0], strdup(src_dir));
+
+    // The calling thread is worker 0, a thread that cannot be started leaves its share to the others
+#ifdef _WIN32
+    HANDLE* threads = calloc(scan.count, sizeof(HANDLE));
+    for(size_t i = 1; i < scan.count; i++) threads[i] = CreateThread(NULL, 0, _nocc_scan_run, &scan.workers[i], 0, NULL);
+    _nocc_scan_run(&scan.workers[0]);
+    for(size_t i = 1; i < scan.count; i++) {
+        if(threads[i] == NULL) continue;
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+#else
+    pthread_t* threads = calloc(scan.count, sizeof(pthread_t));
+    bool* started = calloc(scan.count, sizeof(bool));
+    for(size_t i = 1; i < scan.count; i++) started[i] = pthread_create(&threads[i], NULL, _nocc_scan_run, &scan.workers[i]) == 0;
+    _nocc_scan_run(&scan.workers[0]);
+    for(size_t i = 1; i < scan.count; i++) {
+        if(started[i]) pthread_join(threads[i], NULL);
+    }
+    free(started);
+#endif // _WIN32
+    free(threads);
+
+    bool status = true;
+    size_t first = nocc_da_size(*files);
+    for(size_t i = 0; i < scan.count; i++) {
+        _nocc_scan_worker* worker = &scan.workers[i];
+        if(nocc_da_size(worker->files) > 0) nocc_da_pushn(*files, nocc_da_size(worker->files), (void*)worker->files);
+        if(worker->failed) status = false;
+        nocc_da_free(worker->files);
+        nocc_da_free(worker->dirs);
+        nocc_str_free(worker->names);
+        nocc_str_free(worker->path);
+        if(_nocc_dir_cache.path) _nocc_dir_cache_merge(worker->fresh);
+        nocc_da_free(worker->fresh);
+        nocc_da_free(worker->entries);
+        _nocc_mutex_destroy(&worker->lock);
+    }
+    free(scan.workers);
+    _nocc_cond_destroy(&scan.idle);
+    _nocc_mutex_destroy(&scan.idle_lock);
+
+    // Every worker went its own way through the tree
+    qsort(*files + first, nocc_da_size(*files) - first, sizeof(const char*), _nocc_compare_strings);
+    return status;
 }
 
 /**